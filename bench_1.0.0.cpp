@@ -0,0 +1,608 @@
+
+/*******************************************************************************
+*  The "New BSD License" : http://www.opensource.org/licenses/bsd-license.php  *
+********************************************************************************
+
+Copyright (c) 2010, Mark Turney
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+#include "simple_svg_1.0.0.hpp"
+
+#include <chrono>
+#include <map>
+#include <cstdlib>
+#include <random>
+
+#ifdef __linux__
+#include <cerrno>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+#endif
+
+using namespace svg;
+
+// Serialization benchmarks.  Every scenario runs a number of times and reports the median time
+//  per element, optionally hardware counters per element (--perf, Linux only), and the peak
+//  resident set size of the scenario, which runs in a child process of its own on Linux.
+//
+//  With --baseline the medians are compared to a file written earlier with --json, and the
+//  exit status is 1 when a scenario got slower than the tolerance and the measurement noise
+//  allow.  This is the perf regression gate run by "ctest -L perf".
+//
+//  Usage: simple_svg_bench [--perf] [--repeat N] [--scale F] [--seed N] [--filter NAME[,NAME]]
+//                          [--json FILE] [--baseline FILE] [--tolerance F]
+
+namespace {
+    struct Scenario {
+        std::string name;
+        std::size_t elements;
+        std::function<void()> prepare;
+        std::function<void()> run;
+    };
+
+    enum Counter {
+        Cycles, Instructions, L1Misses, LLCMisses, BranchMisses, CounterCount
+    };
+
+    char const *const counter_names[CounterCount] = {
+        "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"
+    };
+
+    struct Result {
+        Result() : elements(0), peak_rss_kb(0), counters_available(false) {
+            for (int i = 0; i < CounterCount; ++i)
+                counters[i] = -1;
+        }
+
+        std::string name;
+        std::size_t elements;
+        std::vector<double> seconds;
+        double counters[CounterCount];
+        long peak_rss_kb;
+        bool counters_available;
+    };
+
+    double median(std::vector<double> values) {
+        if (values.empty())
+            return 0;
+
+        std::sort(values.begin(), values.end());
+        std::size_t middle = values.size() / 2;
+        return values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+    }
+
+    // Hardware counters around a scenario.  Counters the kernel or container refuses stay
+    //  closed and are reported as unavailable.
+    class Counters {
+    public:
+        Counters() {
+            for (int i = 0; i < CounterCount; ++i)
+                fds[i] = -1;
+        }
+
+        ~Counters() {
+#ifdef __linux__
+            for (int i = 0; i < CounterCount; ++i)
+                if (fds[i] >= 0)
+                    ::close(fds[i]);
+#endif
+        }
+
+        // Returns false with a reason when no counter at all could be opened.
+        bool open(std::string &reason) {
+#ifdef __linux__
+            std::uint64_t const l1d_read_miss = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            std::uint32_t types[CounterCount] = {
+                PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE
+            };
+            std::uint64_t configs[CounterCount] = {
+                PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, l1d_read_miss,
+                PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+            };
+
+            bool any = false;
+            for (int i = 0; i < CounterCount; ++i) {
+                perf_event_attr attr;
+                std::memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                attr.type = types[i];
+                attr.config = configs[i];
+                attr.disabled = 1;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+                fds[i] = int(::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+                if (fds[i] < 0)
+                    reason = std::string("perf_event_open: ") + std::strerror(errno);
+                else
+                    any = true;
+            }
+            return any;
+#else
+            reason = "hardware counters are only supported on Linux";
+            return false;
+#endif
+        }
+
+        void start() {
+#ifdef __linux__
+            for (int i = 0; i < CounterCount; ++i)
+                if (fds[i] >= 0) {
+                    ::ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+                    ::ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+                }
+#endif
+        }
+
+        // Counts since start(), scaled up when the kernel multiplexed the counters.
+        void stop(double *values) {
+            for (int i = 0; i < CounterCount; ++i)
+                values[i] = -1;
+#ifdef __linux__
+            for (int i = 0; i < CounterCount; ++i) {
+                if (fds[i] < 0)
+                    continue;
+
+                ::ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+                std::uint64_t data[3];
+                if (::read(fds[i], data, sizeof(data)) != ssize_t(sizeof(data)) || data[2] == 0)
+                    continue;
+                values[i] = double(data[0]) * double(data[1]) / double(data[2]);
+            }
+#endif
+        }
+
+    private:
+        int fds[CounterCount];
+    };
+
+    long peakRssKb() {
+#ifdef __linux__
+        rusage usage;
+        if (::getrusage(RUSAGE_SELF, &usage) == 0)
+            return usage.ru_maxrss;
+#endif
+        return 0;
+    }
+
+    Result measure(Scenario const &scenario, int repeat, bool use_counters) {
+        Result result;
+        result.name = scenario.name;
+        result.elements = scenario.elements;
+
+        scenario.prepare();
+
+        Counters counters;
+        std::string reason;
+        result.counters_available = use_counters && counters.open(reason);
+        if (use_counters && !result.counters_available)
+            std::cerr << scenario.name << ": counters unavailable (" << reason << ")\n";
+
+        std::vector<double> samples[CounterCount];
+        for (int i = 0; i < repeat; ++i) {
+            double values[CounterCount];
+            auto begin = std::chrono::steady_clock::now();
+            if (result.counters_available)
+                counters.start();
+            scenario.run();
+            if (result.counters_available)
+                counters.stop(values);
+            result.seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count());
+
+            for (int c = 0; result.counters_available && c < CounterCount; ++c)
+                if (values[c] >= 0)
+                    samples[c].push_back(values[c]);
+        }
+
+        for (int c = 0; c < CounterCount; ++c)
+            if (!samples[c].empty())
+                result.counters[c] = median(samples[c]);
+        result.peak_rss_kb = peakRssKb();
+        return result;
+    }
+
+#ifdef __linux__
+    // Run the scenario in a child so its peak RSS is not inflated by earlier scenarios.  The
+    //  result comes back over a pipe as whitespace separated numbers.
+    bool measureIsolated(Scenario const &scenario, int repeat, bool use_counters, Result &result) {
+        int fds[2];
+        if (::pipe(fds) != 0)
+            return false;
+
+        std::cout.flush();
+        pid_t child = ::fork();
+        if (child < 0) {
+            ::close(fds[0]);
+            ::close(fds[1]);
+            return false;
+        }
+
+        if (child == 0) {
+            ::close(fds[0]);
+            Result measured = measure(scenario, repeat, use_counters);
+            std::stringstream ss;
+            ss.precision(17);
+            ss << measured.counters_available << " " << measured.peak_rss_kb << " " << measured.seconds.size();
+            for (double seconds : measured.seconds)
+                ss << " " << seconds;
+            for (int c = 0; c < CounterCount; ++c)
+                ss << " " << measured.counters[c];
+            std::string data = ss.str();
+            bool written = ::write(fds[1], data.data(), data.size()) == ssize_t(data.size());
+            ::close(fds[1]);
+            ::_exit(written ? 0 : 1);
+        }
+
+        ::close(fds[1]);
+        std::string data;
+        char buffer[4096];
+        ssize_t length;
+        while ((length = ::read(fds[0], buffer, sizeof(buffer))) > 0)
+            data.append(buffer, length);
+        ::close(fds[0]);
+
+        int status = 0;
+        ::waitpid(child, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            return false;
+
+        std::stringstream ss(data);
+        std::size_t samples = 0;
+        result.name = scenario.name;
+        result.elements = scenario.elements;
+        ss >> result.counters_available >> result.peak_rss_kb >> samples;
+        result.seconds.resize(samples);
+        for (std::size_t i = 0; i < samples; ++i)
+            ss >> result.seconds[i];
+        for (int c = 0; c < CounterCount; ++c)
+            ss >> result.counters[c];
+        return !ss.fail();
+    }
+#endif
+
+    std::vector<Point> randomWalk(std::size_t count, std::mt19937 &rng, bool integral) {
+        std::uniform_real_distribution<double> step(-1, 1);
+        std::vector<Point> points;
+        points.reserve(count);
+        double y = 500;
+        for (std::size_t i = 0; i < count; ++i) {
+            y += step(rng) * 3;
+            points.push_back(integral ? Point(double(i % 1920), std::floor(y)) : Point(i * .37, y));
+        }
+        return points;
+    }
+
+    // The scenarios keep their inputs alive between repetitions, prepare() builds them outside
+    //  of the measurement.
+    struct Inputs {
+        std::vector<Point> points;
+        std::unique_ptr<Polyline> polyline;
+        std::unique_ptr<Path> path;
+        std::unique_ptr<LineChart> chart;
+        std::unique_ptr<Document> document;
+        std::string output;
+    };
+
+    std::vector<Scenario> scenarios(double scale, unsigned seed, std::shared_ptr<Inputs> const &inputs) {
+        std::size_t const points = std::size_t(1000000 * scale);
+        std::size_t const chart_points = std::size_t(2000 * scale);
+        std::size_t const shapes = std::size_t(100000 * scale);
+
+        std::vector<Scenario> ret;
+
+        Scenario polyline_int;
+        polyline_int.name = "polyline_integer";
+        polyline_int.elements = points;
+        polyline_int.prepare = [=]() {
+            std::mt19937 rng(seed);
+            inputs->polyline.reset(new Polyline(randomWalk(points, rng, true), Fill(), Stroke(1, Color::Black)));
+        };
+        polyline_int.run = [=]() { inputs->output = inputs->polyline->toString(); };
+        ret.push_back(polyline_int);
+
+        Scenario polyline_real = polyline_int;
+        polyline_real.name = "polyline_fractional";
+        polyline_real.prepare = [=]() {
+            std::mt19937 rng(seed);
+            inputs->polyline.reset(new Polyline(randomWalk(points, rng, false), Fill(), Stroke(1, Color::Black)));
+        };
+        ret.push_back(polyline_real);
+
+        Scenario path;
+        path.name = "path";
+        path.elements = points;
+        path.prepare = [=]() {
+            std::mt19937 rng(seed);
+            std::vector<Point> walk = randomWalk(points, rng, false);
+            inputs->path.reset(new Path(Fill(Color::Blue), Stroke(1, Color::Black)));
+            for (std::size_t i = 0; i < walk.size(); ++i) {
+                if (i % 64 == 0)
+                    inputs->path->startNewSubPath();
+                *inputs->path << walk[i];
+            }
+        };
+        path.run = [=]() { inputs->output = inputs->path->toString(); };
+        ret.push_back(path);
+
+        Scenario chart;
+        chart.name = "line_chart";
+        chart.elements = chart_points * 4;
+        chart.prepare = [=]() {
+            std::mt19937 rng(seed);
+            inputs->chart.reset(new LineChart(Dimensions(5, 5)));
+            for (int i = 0; i < 4; ++i)
+                *inputs->chart << Polyline(randomWalk(chart_points, rng, false), Fill(), Stroke(.5, Color::Blue));
+        };
+        chart.run = [=]() { inputs->output = inputs->chart->toString(); };
+        ret.push_back(chart);
+
+        Scenario save;
+        save.name = "document_save";
+        save.elements = shapes;
+        save.prepare = [=]() {
+            std::mt19937 rng(seed);
+            std::uniform_real_distribution<double> coordinate(0, 1000);
+            inputs->document.reset(new Document("simple_svg_bench.svg"));
+            for (std::size_t i = 0; i < shapes; ++i) {
+                if (i % 2)
+                    *inputs->document << Circle(Point(coordinate(rng), coordinate(rng)), 4, Color::Red);
+                else
+                    *inputs->document << Rectangle(Point(coordinate(rng), coordinate(rng)), 3, 2, Color::Blue);
+            }
+        };
+        save.run = [=]() {
+            if (!inputs->document->save())
+                std::cerr << "document_save: cannot write simple_svg_bench.svg\n";
+        };
+        ret.push_back(save);
+
+        return ret;
+    }
+
+    void printResult(Result const &result) {
+        double elements = double(std::max<std::size_t>(1, result.elements));
+        std::printf("%-20s %10zu %12.2f", result.name.c_str(), result.elements, median(result.seconds) * 1e9 / elements);
+        for (int c = 0; c < CounterCount; ++c) {
+            if (result.counters[c] >= 0)
+                std::printf(" %12.3f", result.counters[c] / elements);
+            else
+                std::printf(" %12s", "n/a");
+        }
+        std::printf(" %12ld\n", result.peak_rss_kb);
+        std::fflush(stdout);
+    }
+
+    // Median absolute deviation scaled to estimate the standard deviation.
+    double noise(std::vector<double> const &values) {
+        double center = median(values);
+        std::vector<double> deviations;
+        for (double value : values)
+            deviations.push_back(std::fabs(value - center));
+        return 1.4826 * median(deviations);
+    }
+
+    bool matchesFilter(std::string const &name, std::string const &filter) {
+        if (filter.empty())
+            return true;
+
+        std::stringstream ss(filter);
+        std::string part;
+        while (std::getline(ss, part, ','))
+            if (!part.empty() && name.find(part) != std::string::npos)
+                return true;
+        return false;
+    }
+
+    // Value following "key": on a line of the files written by toJson().
+    bool jsonValue(std::string const &line, std::string const &key, std::string &value) {
+        std::size_t position = line.find("\"" + key + "\": ");
+        if (position == std::string::npos)
+            return false;
+
+        position += key.size() + 4;
+        std::size_t end = line[position] == '"' ? line.find('"', position + 1) + 1
+                                                : line.find_first_of(",}", position);
+        if (line[position] == '[')
+            end = line.find(']', position) + 1;
+        value = line.substr(position, end - position);
+        return true;
+    }
+
+    struct Baseline {
+        Baseline() : elements(0), tolerance(-1) {}
+
+        std::size_t elements;
+        std::vector<double> seconds;
+        double tolerance;
+    };
+
+    // Scenarios of a file written with --json, a scenario may carry its own "tolerance".
+    bool readBaseline(std::string const &file_name, std::map<std::string, Baseline> &baselines) {
+        std::ifstream ifs(file_name.c_str());
+        if (!ifs.good())
+            return false;
+
+        std::string line;
+        while (std::getline(ifs, line)) {
+            std::string name, value;
+            if (!jsonValue(line, "name", name) || name.size() < 2)
+                continue;
+
+            Baseline baseline;
+            if (jsonValue(line, "elements", value))
+                baseline.elements = std::size_t(std::atof(value.c_str()));
+            if (jsonValue(line, "tolerance", value))
+                baseline.tolerance = std::atof(value.c_str());
+            if (jsonValue(line, "seconds", value)) {
+                std::stringstream ss(value.substr(1, value.size() - 2));
+                std::string sample;
+                while (std::getline(ss, sample, ','))
+                    baseline.seconds.push_back(std::atof(sample.c_str()));
+            }
+            baselines[name.substr(1, name.size() - 2)] = baseline;
+        }
+        return true;
+    }
+
+    // A scenario regresses when its median time per element exceeds the baseline by more than
+    //  the tolerance and by more than three times the noise of either run, so a noisy shared
+    //  machine does not fail the gate on its own.
+    bool compare(std::vector<Result> const &results, std::map<std::string, Baseline> const &baselines,
+                 double default_tolerance) {
+        bool passed = true;
+        for (auto const &result : results) {
+            auto found = baselines.find(result.name);
+            if (found == baselines.end() || found->second.seconds.empty()) {
+                std::printf("%-20s no baseline\n", result.name.c_str());
+                continue;
+            }
+
+            Baseline const &baseline = found->second;
+            double scale = double(std::max<std::size_t>(1, result.elements));
+            double base_scale = double(std::max<std::size_t>(1, baseline.elements));
+            double current = median(result.seconds) / scale;
+            double reference = median(baseline.seconds) / base_scale;
+            double spread = std::max(noise(result.seconds) / scale, noise(baseline.seconds) / base_scale);
+            double tolerance = baseline.tolerance >= 0 ? baseline.tolerance : default_tolerance;
+
+            double change = current / reference - 1;
+            bool regressed = change > tolerance && current - reference > 3 * spread;
+            std::printf("%-20s %+7.1f%% (tolerance %.0f%%, noise %.1f%%) %s\n", result.name.c_str(), change * 100,
+                        tolerance * 100, spread / reference * 100, regressed ? "REGRESSED" : "ok");
+            passed = passed && !regressed;
+        }
+        return passed;
+    }
+
+    std::string toJson(std::vector<Result> const &results) {
+        std::stringstream ss;
+        ss.precision(9);
+        ss << "{\n  \"scenarios\": [\n";
+        for (std::size_t i = 0; i < results.size(); ++i) {
+            Result const &result = results[i];
+            ss << "    {\"name\": \"" << result.name << "\", \"elements\": " << result.elements
+               << ", \"median_seconds\": " << median(result.seconds)
+               << ", \"peak_rss_kb\": " << result.peak_rss_kb << ", \"seconds\": [";
+            for (std::size_t s = 0; s < result.seconds.size(); ++s)
+                ss << (s ? ", " : "") << result.seconds[s];
+            ss << "]";
+            for (int c = 0; c < CounterCount; ++c)
+                if (result.counters[c] >= 0)
+                    ss << ", \"" << counter_names[c] << "\": " << result.counters[c];
+            ss << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        ss << "  ]\n}\n";
+        return ss.str();
+    }
+}
+
+int main(int argc, char **argv) {
+    bool use_counters = false;
+    int repeat = 5;
+    double scale = 1;
+    unsigned seed = 42;
+    std::string filter;
+    std::string json_file;
+    std::string baseline_file;
+    double tolerance = .25;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--perf")
+            use_counters = true;
+        else if (arg == "--repeat" && has_value)
+            repeat = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--scale" && has_value)
+            scale = std::atof(argv[++i]);
+        else if (arg == "--seed" && has_value)
+            seed = unsigned(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "--filter" && has_value)
+            filter = argv[++i];
+        else if (arg == "--json" && has_value)
+            json_file = argv[++i];
+        else if (arg == "--baseline" && has_value)
+            baseline_file = argv[++i];
+        else if (arg == "--tolerance" && has_value)
+            tolerance = std::atof(argv[++i]);
+        else {
+            bool help = arg == "--help" || arg == "-h";
+            (help ? std::cout : std::cerr)
+                    << "usage: " << argv[0] << " [--perf] [--repeat N] [--scale F] [--seed N] [--filter NAME[,NAME]]"
+                    << " [--json FILE] [--baseline FILE] [--tolerance F]\n";
+            return help ? 0 : 2;
+        }
+    }
+
+    std::map<std::string, Baseline> baselines;
+    if (!baseline_file.empty() && !readBaseline(baseline_file, baselines)) {
+        std::cerr << "cannot read " << baseline_file << "\n";
+        return 2;
+    }
+
+    std::printf("%-20s %10s %12s", "scenario", "elements", "ns/elem");
+    for (int c = 0; c < CounterCount; ++c)
+        std::printf(" %12s", counter_names[c]);
+    std::printf(" %12s\n", "peak_rss_kb");
+
+    std::shared_ptr<Inputs> inputs = std::make_shared<Inputs>();
+    std::vector<Result> results;
+    for (auto const &scenario : scenarios(scale, seed, inputs)) {
+        if (!matchesFilter(scenario.name, filter))
+            continue;
+
+        Result result;
+#ifdef __linux__
+        if (!measureIsolated(scenario, repeat, use_counters, result))
+            result = measure(scenario, repeat, use_counters);
+#else
+        result = measure(scenario, repeat, use_counters);
+#endif
+        printResult(result);
+        results.push_back(result);
+    }
+    std::remove("simple_svg_bench.svg");
+
+    if (!json_file.empty()) {
+        std::ofstream ofs(json_file.c_str());
+        ofs << toJson(results);
+        if (!ofs.good()) {
+            std::cerr << "cannot write " << json_file << "\n";
+            return 1;
+        }
+    }
+
+    if (!baseline_file.empty() && !compare(results, baselines, tolerance))
+        return 1;
+    return 0;
+}
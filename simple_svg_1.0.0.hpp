@@ -37,9 +37,45 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <memory>
+#include <cstdint>
+#include <unordered_set>
+#include <unordered_map>
+#include <typeindex>
+#include <initializer_list>
+#include <algorithm>
+#include <functional>
+#include <thread>
+#include <exception>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <complex>
+#include <limits>
 
 #include <iostream>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SVG_HAS_SSE2
+#endif
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#include <type_traits>
+#define SVG_HAS_COROUTINES
+#endif
+
+#ifdef SVG_PREVIEW_SERVER
+#include <cerrno>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
 namespace svg {
     // Utility XML/String Functions.
     template<typename T>
@@ -62,16 +98,123 @@ namespace svg {
         return "/>\n";
     }
 
+    // 64 bit FNV-1a hash, used to derive stable ids from serialized definitions.
+    static inline std::uint64_t hashString(std::string const &str) {
+        std::uint64_t hash = 14695981039346656037ULL;
+        for (unsigned char c : str) {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    // Split [0, count) into contiguous chunks and call fn(begin, end) for each chunk on up to
+    //  `threads` threads (0 uses the hardware concurrency).  The calling thread takes the first
+    //  chunk, and the first exception thrown by any chunk is rethrown after all have joined.
+    template<typename F>
+    void parallelFor(std::size_t count, F const &fn, unsigned threads = 0) {
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        if (threads > count)
+            threads = static_cast<unsigned>(count);
+        if (threads <= 1) {
+            if (count)
+                fn(std::size_t(0), count);
+            return;
+        }
+
+        std::size_t chunk = (count + threads - 1) / threads;
+        std::vector<std::exception_ptr> errors(threads);
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < threads; ++t) {
+            std::size_t begin = t * chunk;
+            std::size_t end = std::min(count, begin + chunk);
+            if (begin >= end)
+                break;
+            workers.emplace_back([&fn, &errors, t, begin, end]() {
+                try {
+                    fn(begin, end);
+                } catch (...) {
+                    errors[t] = std::current_exception();
+                }
+            });
+        }
+
+        try {
+            fn(std::size_t(0), std::min(count, chunk));
+        } catch (...) {
+            errors[0] = std::current_exception();
+        }
+        for (auto &worker : workers)
+            worker.join();
+        for (auto const &error : errors)
+            if (error)
+                std::rethrow_exception(error);
+    }
+
+    // Stable LSD radix sort of keys, permuting values alongside.  Every pass histograms and
+    //  scatters contiguous chunks on separate threads, bytes that are zero in all keys are
+    //  skipped.
+    static inline void radixSort(std::vector<std::uint64_t> &keys, std::vector<std::uint32_t> &values,
+                                 unsigned threads = 0) {
+        std::size_t const count = keys.size();
+        std::uint64_t used = 0;
+        for (std::size_t i = 0; i < count; ++i)
+            used |= keys[i];
+
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        if (count < (1 << 16))
+            threads = 1;
+        std::size_t const chunk = (count + threads - 1) / threads;
+
+        std::vector<std::uint64_t> key_buffer(count);
+        std::vector<std::uint32_t> value_buffer(count);
+        std::vector<std::size_t> offsets(threads * 256);
+        for (unsigned shift = 0; shift < 64; shift += 8) {
+            if (((used >> shift) & 0xff) == 0)
+                continue;
+
+            std::fill(offsets.begin(), offsets.end(), 0);
+            parallelFor(threads, [&](std::size_t first, std::size_t last) {
+                for (std::size_t t = first; t < last; ++t)
+                    for (std::size_t i = t * chunk; i < std::min(count, (t + 1) * chunk); ++i)
+                        ++offsets[t * 256 + ((keys[i] >> shift) & 0xff)];
+            }, threads);
+
+            // Digit major, chunk minor: equal digits keep the order of their chunks.
+            std::size_t total = 0;
+            for (std::size_t digit = 0; digit < 256; ++digit)
+                for (std::size_t t = 0; t < threads; ++t) {
+                    std::size_t n = offsets[t * 256 + digit];
+                    offsets[t * 256 + digit] = total;
+                    total += n;
+                }
+
+            parallelFor(threads, [&](std::size_t first, std::size_t last) {
+                for (std::size_t t = first; t < last; ++t)
+                    for (std::size_t i = t * chunk; i < std::min(count, (t + 1) * chunk); ++i) {
+                        std::size_t position = offsets[t * 256 + ((keys[i] >> shift) & 0xff)]++;
+                        key_buffer[position] = keys[i];
+                        value_buffer[position] = values[i];
+                    }
+            }, threads);
+
+            keys.swap(key_buffer);
+            values.swap(value_buffer);
+        }
+    }
+
     // Quick optional return type.  This allows functions to return an invalid
     //  value if no good return is possible.  The user checks for validity
     //  before using the returned value.
     template<typename T>
     class optional {
     public:
-        optional<T>(T const &type)
+        optional(T const &type)
                 : valid(true), type(type) {}
 
-        optional<T>() : valid(false), type(T()) {}
+        optional() : valid(false), type(T()) {}
 
         T *operator->() {
             // If we try to access an invalid value, an exception is thrown.
@@ -141,32 +284,421 @@ namespace svg {
         }
     };
 
+    // Non-finite samples mark gaps in a series.  x - x is NaN for NaN and both infinities, the
+    //  test is evaluated without short circuiting so that scans over many points vectorize.
+    static inline bool isFinite(Point const &point) {
+        return (point.x - point.x == 0) & (point.y - point.y == 0);
+    }
+
+    // Writes 1 for each finite point and 0 for each gap, returns the number of finite points.
+    static inline std::size_t finiteMask(Point const *points, std::size_t count, unsigned char *mask) {
+        std::size_t finite = 0;
+        for (std::size_t i = 0; i < count; ++i) {
+            mask[i] = isFinite(points[i]);
+            finite += mask[i];
+        }
+        return finite;
+    }
+
+    // Calls fn(begin, end) for each run of finite points, the runs are found by scanning a
+    //  mask of the whole series.  Returns false when there are no gaps, in which case fn is
+    //  not called and the series is one run.
+    template <typename Function>
+    static inline bool forEachFiniteRun(Point const *points, std::size_t count, Function fn) {
+        std::vector<unsigned char> mask(count);
+        if (count == 0 || finiteMask(points, count, &mask[0]) == count)
+            return false;
+
+        unsigned char const *begin = mask.data();
+        std::size_t i = 0;
+        while (i < count) {
+            void const *run = std::memchr(begin + i, 1, count - i);
+            if (!run)
+                break;
+
+            i = static_cast<unsigned char const *>(run) - begin;
+            void const *gap = std::memchr(begin + i, 0, count - i);
+            std::size_t end = gap ? static_cast<unsigned char const *>(gap) - begin : count;
+            fn(i, end);
+            i = end;
+        }
+        return true;
+    }
+
+    // Bounds of the finite points, false when there are none.
+    static inline bool finiteBounds(Point const *points, std::size_t count, Rect &bounds) {
+        double min_x = HUGE_VAL, min_y = HUGE_VAL, max_x = -HUGE_VAL, max_y = -HUGE_VAL;
+        for (std::size_t i = 0; i < count; ++i) {
+            bool finite = isFinite(points[i]);
+            min_x = std::min(min_x, finite ? points[i].x : HUGE_VAL);
+            min_y = std::min(min_y, finite ? points[i].y : HUGE_VAL);
+            max_x = std::max(max_x, finite ? points[i].x : -HUGE_VAL);
+            max_y = std::max(max_y, finite ? points[i].y : -HUGE_VAL);
+        }
+        if (min_x > max_x)
+            return false;
+
+        bounds.minPt = Point(min_x, min_y);
+        bounds.maxPt = Point(max_x, max_y);
+        return true;
+    }
+
+    static inline bool finiteBounds(std::vector<Point> const &points, Rect &bounds) {
+        return !points.empty() && finiteBounds(&points[0], points.size(), bounds);
+    }
+
+    // Minimum of `lower` and maximum of `upper`, skipping non-finite values, which v + (v - v)
+    //  turns into NaN.  minpd and maxpd return their second operand when either is NaN, so
+    //  NaN never reaches the accumulators.  Compilers do not vectorize such reductions
+    //  without -ffast-math, hence the intrinsics.  Returns false when nothing was finite.
+    static inline bool minMax(double const *lower, double const *upper, std::size_t count,
+                              double &min, double &max) {
+        double lo = HUGE_VAL, hi = -HUGE_VAL;
+        std::size_t i = 0;
+#ifdef SVG_HAS_SSE2
+        __m128d lo2 = _mm_set1_pd(lo), hi2 = _mm_set1_pd(hi);
+        for (; i + 2 <= count; i += 2) {
+            __m128d l = _mm_loadu_pd(lower + i), u = _mm_loadu_pd(upper + i);
+            lo2 = _mm_min_pd(_mm_add_pd(l, _mm_sub_pd(l, l)), lo2);
+            hi2 = _mm_max_pd(_mm_add_pd(u, _mm_sub_pd(u, u)), hi2);
+        }
+        double lanes[2];
+        _mm_storeu_pd(lanes, lo2);
+        lo = std::min(lanes[0], lanes[1]);
+        _mm_storeu_pd(lanes, hi2);
+        hi = std::max(lanes[0], lanes[1]);
+#endif
+        for (; i < count; ++i) {
+            double l = lower[i] + (lower[i] - lower[i]), u = upper[i] + (upper[i] - upper[i]);
+            lo = l < lo ? l : lo;
+            hi = u > hi ? u : hi;
+        }
+        if (lo > hi)
+            return false;
+
+        min = lo;
+        max = hi;
+        return true;
+    }
+
     static inline optional<Point> getMinPoint(std::vector<Point> const &points) {
-        if (points.empty())
+        Rect bounds;
+        if (!finiteBounds(points, bounds))
             return optional<Point>();
 
-        Point min = points[0];
-        for (unsigned i = 0; i < points.size(); ++i) {
-            if (points[i].x < min.x)
-                min.x = points[i].x;
-            if (points[i].y < min.y)
-                min.y = points[i].y;
-        }
-        return optional<Point>(min);
+        return optional<Point>(bounds.minPt);
     }
 
     static inline optional<Point> getMaxPoint(std::vector<Point> const &points) {
-        if (points.empty())
+        Rect bounds;
+        if (!finiteBounds(points, bounds))
             return optional<Point>();
 
-        Point max = points[0];
-        for (unsigned i = 0; i < points.size(); ++i) {
-            if (points[i].x > max.x)
-                max.x = points[i].x;
-            if (points[i].y > max.y)
-                max.y = points[i].y;
+        return optional<Point>(bounds.maxPt);
+    }
+
+    // Number formatting.  Output matches streaming a double with the default precision, but
+    //  integers, which dominate quantized screen space coordinates, skip printf entirely and
+    //  are converted two digits at a time through a lookup table.
+    static inline char const *digitPairs() {
+        static char const pairs[] =
+                "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+                "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+                "8081828384858687888990919293949596979899";
+        return pairs;
+    }
+
+    // Write the decimal representation of value to out, returning the end of the written text.
+    static inline char *formatInt(char *out, std::int32_t value) {
+        std::uint32_t magnitude = static_cast<std::uint32_t>(value);
+        if (value < 0) {
+            *out++ = '-';
+            magnitude = 0u - magnitude;
+        }
+
+        char buffer[10];
+        char *end = buffer + sizeof(buffer);
+        char *begin = end;
+        while (magnitude >= 100) {
+            std::uint32_t pair = (magnitude % 100) * 2;
+            magnitude /= 100;
+            begin -= 2;
+            begin[0] = digitPairs()[pair];
+            begin[1] = digitPairs()[pair + 1];
+        }
+        if (magnitude >= 10) {
+            begin -= 2;
+            begin[0] = digitPairs()[magnitude * 2];
+            begin[1] = digitPairs()[magnitude * 2 + 1];
+        } else
+            *--begin = char('0' + magnitude);
+
+        std::memcpy(out, begin, end - begin);
+        return out + (end - begin);
+    }
+
+    // Writes value / 10^decimals, dropping trailing zeros of the fraction.
+    static inline char *formatFixed(char *out, std::int64_t value, int decimals) {
+        std::uint64_t magnitude = static_cast<std::uint64_t>(value);
+        if (value < 0) {
+            *out++ = '-';
+            magnitude = 0u - magnitude;
+        }
+
+        char buffer[24];
+        char *end = buffer + sizeof(buffer);
+        char *begin = end;
+        for (int digit = 0; digit < decimals; ++digit, magnitude /= 10)
+            if (begin != end || magnitude % 10 != 0)
+                *--begin = char('0' + magnitude % 10);
+        if (begin != end)
+            *--begin = '.';
+        do {
+            *--begin = char('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude != 0);
+
+        std::memcpy(out, begin, end - begin);
+        return out + (end - begin);
+    }
+
+    // Integer value of v if streaming it would print that integer.  Values from a million up
+    //  are printed in exponent form, negative zero keeps its sign, and NaN fails the comparison.
+    static inline bool quantize(double v, std::int32_t &quantized) {
+        quantized = static_cast<std::int32_t>(v > -1000000.0 && v < 1000000.0 ? v : 0);
+        return double(quantized) == v && std::signbit(v) == (quantized < 0);
+    }
+
+    static inline void appendNumber(std::string &out, double value) {
+        char buffer[32];
+        std::int32_t quantized;
+        if (quantize(value, quantized)) {
+            out.append(buffer, formatInt(buffer, quantized));
+            return;
+        }
+
+        int length = std::snprintf(buffer, sizeof(buffer), "%g", value);
+        out.append(buffer, length);
+    }
+
+    // Append "x,y " for each point.  Points are processed in blocks, blocks made of integers
+    //  only are quantized without branching per coordinate and then written straight into the
+    //  output buffer.
+    static inline void appendPoints(std::string &out, Point const *points, std::size_t count) {
+        static const std::size_t block_size = 256;
+        std::int32_t xy[block_size * 2];
+
+        for (std::size_t begin = 0; begin < count; begin += block_size) {
+            std::size_t n = std::min(block_size, count - begin);
+            Point const *block = points + begin;
+
+            bool integral = true;
+            for (std::size_t i = 0; i < n; ++i) {
+                integral &= quantize(block[i].x, xy[i * 2]);
+                integral &= quantize(block[i].y, xy[i * 2 + 1]);
+            }
+
+            // Gaps fail quantization too and are left out rather than written as "nan,nan".
+            if (!integral) {
+                for (std::size_t i = 0; i < n; ++i) {
+                    if (!isFinite(block[i]))
+                        continue;
+
+                    appendNumber(out, block[i].x);
+                    out += ',';
+                    appendNumber(out, block[i].y);
+                    out += ' ';
+                }
+                continue;
+            }
+
+            // At most 7 characters per coordinate plus the separators.
+            std::size_t offset = out.size();
+            out.resize(offset + n * 16);
+            char *cursor = &out[offset];
+            for (std::size_t i = 0; i < n; ++i) {
+                cursor = formatInt(cursor, xy[i * 2]);
+                *cursor++ = ',';
+                cursor = formatInt(cursor, xy[i * 2 + 1]);
+                *cursor++ = ' ';
+            }
+            out.resize(cursor - &out[0]);
+        }
+    }
+
+    static inline void appendPoints(std::string &out, std::vector<Point> const &points) {
+        if (!points.empty())
+            appendPoints(out, &points[0], points.size());
+    }
+
+    // Logarithm and exponential built from the bit layout of doubles, so that loops over many
+    //  values vectorize instead of calling libm per value.  The mantissa is reduced to
+    //  [sqrt(1/2), sqrt(2)) and log evaluated from the atanh series, the error is below 1e-10,
+    //  far under a pixel at any output resolution.  Inputs must be positive and finite,
+    //  subnormals evaluate to about the logarithm of the smallest normal value.
+    static inline double fastLog2(double value) {
+        // Offsetting the bits by those of sqrt(1/2) makes the exponent field round to the
+        //  nearest power of two, the mantissa is then rebuilt relative to sqrt(1/2).
+        static const std::uint64_t sqrt_half_bits = 0x3FE6A09E667F3BCDull;
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        bits += 0x3FF0000000000000ull - sqrt_half_bits;
+        std::uint64_t exponent_bits = (bits >> 52) | 0x4330000000000000ull;
+        std::uint64_t mantissa_bits = (bits & 0x000FFFFFFFFFFFFFull) + sqrt_half_bits;
+        double exponent, mantissa;
+        std::memcpy(&exponent, &exponent_bits, sizeof(exponent));
+        std::memcpy(&mantissa, &mantissa_bits, sizeof(mantissa));
+        exponent -= 4503599627370496.0 + 1023.0;
+
+        double f = (mantissa - 1.0) / (mantissa + 1.0);
+        double s = f * f;
+        double series = 1.0 + s * (1.0 / 3 + s * (1.0 / 5 + s * (1.0 / 7 + s * (1.0 / 9 + s * (1.0 / 11)))));
+        return exponent + 2.0 * f * series * 1.4426950408889634;
+    }
+
+    // 2^value, values below -1022.5 flush to zero and above 1023 saturate.  The clamp is
+    //  written as arithmetic, selecting constants would let the compiler split the loop into
+    //  paths that no longer vectorize.  It costs an error of about 1e-13.
+    static inline double fastExp2(double value) {
+        static const double round_magic = 6755399441055744.0;
+        value = 0.5 * (std::fabs(value + 1023.0) - std::fabs(value - 1023.0));
+
+        double shifted = value + round_magic;
+        double whole = shifted - round_magic;
+        double g = (value - whole) * 0.6931471805599453;
+        double fraction = 1.0 + g * (1.0 + g * (1.0 / 2 + g * (1.0 / 6 + g * (1.0 / 24 + g * (1.0 / 120
+                          + g * (1.0 / 720 + g * (1.0 / 5040 + g * (1.0 / 40320 + g * (1.0 / 362880
+                          + g * (1.0 / 3628800 + g * (1.0 / 39916800)))))))))));
+
+        std::uint64_t shifted_bits, magic_bits;
+        std::memcpy(&shifted_bits, &shifted, sizeof(shifted_bits));
+        std::memcpy(&magic_bits, &round_magic, sizeof(magic_bits));
+        std::uint64_t power_bits = (shifted_bits - magic_bits + 1023) << 52;
+        double power;
+        std::memcpy(&power, &power_bits, sizeof(power));
+        return fraction * power;
+    }
+
+    // Sines and cosines of many angles at once.  Angles are reduced to [-pi/4, pi/4] around
+    //  the nearest quarter turn, both series are evaluated for every angle and the quadrant
+    //  swaps and negates them, so the loop has no branches.  The error is below 1e-13 for
+    //  angles up to 1e6 radians.
+    static inline void sinCos(double const *angles, std::size_t count, double *sines, double *cosines) {
+        static const double round_magic = 6755399441055744.0;
+        for (std::size_t i = 0; i < count; ++i) {
+            double shifted = angles[i] * 0.6366197723675814 + round_magic;
+            double quarter = shifted - round_magic;
+            double r = (angles[i] - quarter * 1.57079632673412561417) - quarter * 6.07710050650619224932e-11;
+            double s = r * r;
+            double sine = r + r * s * (-1.0 / 6 + s * (1.0 / 120 + s * (-1.0 / 5040 + s * (1.0 / 362880
+                          + s * (-1.0 / 39916800 + s * (1.0 / 6227020800))))));
+            double cosine = 1.0 + s * (-1.0 / 2 + s * (1.0 / 24 + s * (-1.0 / 720 + s * (1.0 / 40320
+                            + s * (-1.0 / 3628800 + s * (1.0 / 479001600 + s * (-1.0 / 87178291200)))))));
+
+            // Swapping and negating through bit masks needs no 64-bit compares.
+            std::uint64_t quadrant, sine_bits, cosine_bits;
+            std::memcpy(&quadrant, &shifted, sizeof(quadrant));
+            std::memcpy(&sine_bits, &sine, sizeof(sine_bits));
+            std::memcpy(&cosine_bits, &cosine, sizeof(cosine_bits));
+            std::uint64_t swap = 0 - (quadrant & 1);
+            std::uint64_t sin_bits = (sine_bits & ~swap) | (cosine_bits & swap);
+            std::uint64_t cos_bits = (cosine_bits & ~swap) | (sine_bits & swap);
+            sin_bits ^= (quadrant & 2) << 62;
+            cos_bits ^= ((quadrant + 1) & 2) << 62;
+            std::memcpy(&sines[i], &sin_bits, sizeof(sin_bits));
+            std::memcpy(&cosines[i], &cos_bits, sizeof(cos_bits));
+        }
+    }
+
+    // Axis transform applied to data before it is laid out, see LineChart::setScales.  Log maps
+    //  non-positive values to gaps, symlog is sign(v) * log10(1 + |v| / constant), which stays
+    //  linear around zero, and power raises |v| to the exponent keeping the sign.  Non-finite
+    //  values stay non-finite.  Bases other than positive and not 1, non-positive constants and
+    //  zero exponents have no meaningful transform and throw std::out_of_range.
+    struct Scale {
+        enum Type {
+            Linear, Log, SymLog, Power
+        };
+
+        Scale(Type type = Linear, double parameter = 1) : type(type), parameter(parameter) {
+            bool finite = parameter - parameter == 0;
+            if (type == Log && !(finite && parameter > 0 && parameter != 1))
+                throw std::out_of_range("svg::Scale: log base must be positive and not 1");
+            if (type == SymLog && !(finite && parameter > 0))
+                throw std::out_of_range("svg::Scale: symlog constant must be positive");
+            if (type == Power && !(finite && parameter != 0))
+                throw std::out_of_range("svg::Scale: power exponent must be finite and not 0");
+        }
+
+        static Scale log(double base = 10) { return Scale(Log, base); }
+        static Scale symlog(double constant = 1) { return Scale(SymLog, constant); }
+        static Scale power(double exponent) { return Scale(Power, exponent); }
+
+        Type type;
+        double parameter;
+
+        double operator()(double value) const {
+            apply(&value, 1);
+            return value;
+        }
+
+        // Transform values in place.  Each scale is a single loop whose result is always
+        //  computed, special values are folded in by adding 0, NaN or the infinite input.
+        void apply(double *values, std::size_t count) const {
+            double nan = std::numeric_limits<double>::quiet_NaN();
+            if (type == Log) {
+                double factor = 1.0 / fastLog2(parameter);
+                for (std::size_t i = 0; i < count; ++i) {
+                    double v = values[i];
+                    double special = v > 0 ? (v < HUGE_VAL ? 0.0 : HUGE_VAL) : nan;
+                    values[i] = fastLog2(v) * factor + special;
+                }
+            }
+            else if (type == SymLog) {
+                double inverse = 1.0 / parameter;
+                for (std::size_t i = 0; i < count; ++i) {
+                    double v = values[i];
+                    double special = v - v == 0 ? 0.0 : v;
+                    double r = fastLog2(1.0 + std::fabs(v) * inverse) * 0.30102999566398120;
+                    values[i] = std::copysign(r, v) + special;
+                }
+            }
+            else if (type == Power) {
+                for (std::size_t i = 0; i < count; ++i) {
+                    double v = values[i];
+                    double magnitude = std::fabs(v);
+                    double special = v - v == 0 ? 0.0 : v;
+                    // Pushing the logarithm of zero far below the clamp makes 0^p exactly 0,
+                    //  or infinite for negative exponents like any other overflow.
+                    double zero = magnitude > 0 ? 0.0 : 1e6;
+                    double exponent = parameter * (fastLog2(magnitude) - zero);
+                    double overflow = exponent < 1023.0 ? 0.0 : HUGE_VAL;
+                    values[i] = std::copysign(fastExp2(exponent) + overflow, v) + special;
+                }
+            }
+        }
+    };
+
+    // Apply axis scales to points in place, coordinates are gathered into blocks so that the
+    //  transforms run over contiguous arrays.
+    static inline void scalePoints(Point *points, std::size_t count, Scale const &x_scale, Scale const &y_scale) {
+        if (x_scale.type == Scale::Linear && y_scale.type == Scale::Linear)
+            return;
+
+        static const std::size_t block_size = 256;
+        double xs[block_size], ys[block_size];
+        for (std::size_t begin = 0; begin < count; begin += block_size) {
+            std::size_t n = std::min(block_size, count - begin);
+            Point *block = points + begin;
+            for (std::size_t i = 0; i < n; ++i) {
+                xs[i] = block[i].x;
+                ys[i] = block[i].y;
+            }
+            x_scale.apply(xs, n);
+            y_scale.apply(ys, n);
+            for (std::size_t i = 0; i < n; ++i)
+                block[i] = Point(xs[i], ys[i]);
         }
-        return optional<Point>(max);
     }
 
     // Defines the dimensions, scale, origin, and origin offset of the document.
@@ -204,6 +736,65 @@ namespace svg {
         return dimension * layout.scale;
     }
 
+    template<typename T>
+    std::string vectorToString(std::vector<T> collection, Layout const &layout) {
+        std::string combination_str;
+        for (unsigned i = 0; i < collection.size(); ++i)
+            combination_str += collection[i].toString();
+
+        return combination_str;
+    }
+
+    template<typename T>
+    std::string vectorToString(std::vector<T> collection) {
+        std::string combination_str;
+        for (unsigned i = 0; i < collection.size(); ++i)
+            combination_str += collection[i].toString();
+
+        return combination_str;
+    }
+
+    // Approximate memory held by a document or shape, in bytes.  Containers are counted by
+    //  capacity, so the figures include reserved but unused space.
+    struct MemoryUsage {
+        MemoryUsage() : objects(0), points(0), strings(0), definitions(0), buffers(0) {}
+
+        std::size_t objects;      // The shape and document objects themselves.
+        std::size_t points;       // Coordinate storage.
+        std::size_t strings;      // Text content and serialized markup.
+        std::size_t definitions;  // Gradients, patterns, symbols and style rules.
+        std::size_t buffers;      // Indices and other bookkeeping.
+
+        std::size_t total() const { return objects + points + strings + definitions + buffers; }
+
+        MemoryUsage &operator+=(MemoryUsage const &other) {
+            objects += other.objects;
+            points += other.points;
+            strings += other.strings;
+            definitions += other.definitions;
+            buffers += other.buffers;
+            return *this;
+        }
+    };
+
+    // Heap memory of a string, nothing while it fits the small string buffer.
+    static inline std::size_t stringMemory(std::string const &str) {
+        static const std::size_t small = std::string().capacity();
+        return str.capacity() > small ? str.capacity() + 1 : 0;
+    }
+
+    template<typename T>
+    std::size_t vectorMemory(std::vector<T> const &vector) {
+        return vector.capacity() * sizeof(T);
+    }
+
+    // Bucket array plus one node per element of an unordered container.
+    template<typename T>
+    std::size_t hashMemory(T const &container) {
+        return container.bucket_count() * sizeof(void *)
+               + container.size() * (sizeof(typename T::value_type) + 2 * sizeof(void *));
+    }
+
     class Serializeable {
     public:
         Serializeable() {}
@@ -300,6 +891,204 @@ namespace svg {
         }
     };
 
+    // A serialized entry of the <defs> section.  The id is derived from the content, so two
+    //  definitions with the same value always share the same id.
+    struct Definition {
+        std::string id;
+        std::string content;
+        // Plain color used by backends that cannot reference definitions.
+        std::string fallback;
+        std::vector<std::shared_ptr<const Definition> > dependencies;
+    };
+
+    // Ordered, deduplicated set of definitions referenced by the shapes of a document.
+    class Definitions : public Serializeable {
+    public:
+        Definitions() {}
+
+        void add(std::shared_ptr<const Definition> const &definition) {
+            // Shapes sharing a Fill share the definition pointer, skip the lookup for runs of them.
+            if (!definition || definition == last_added)
+                return;
+            last_added = definition;
+
+            if (!ids.insert(definition->id).second)
+                return;
+
+            for (auto const &dependency : definition->dependencies)
+                add(dependency);
+            ordered.push_back(definition);
+        }
+
+        void add(Definitions const &other) {
+            for (auto const &definition : other.ordered)
+                add(definition);
+        }
+
+        bool empty() const { return ordered.empty(); }
+
+        std::vector<std::shared_ptr<const Definition> > const &items() const { return ordered; }
+
+        std::size_t size() const { return ordered.size(); }
+
+        bool contains(std::string const &id) const { return ids.count(id) != 0; }
+
+        // Definitions without the enclosing <defs> element.
+        std::string contentString() const {
+            std::string ret;
+            for (auto const &definition : ordered)
+                ret += definition->content;
+            return ret;
+        }
+
+        std::string toString() const {
+            if (ordered.empty())
+                return "";
+
+            return "<defs>\n" + contentString() + elemEnd("defs");
+        }
+
+        // Content of the definitions and the index used to deduplicate them.
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret;
+            ret.buffers = vectorMemory(ordered) + hashMemory(ids);
+            for (auto const &definition : ordered)
+                ret.definitions += sizeof(Definition) + stringMemory(definition->id)
+                                   + stringMemory(definition->content) + stringMemory(definition->fallback);
+            for (auto const &id : ids)
+                ret.buffers += stringMemory(id);
+            return ret;
+        }
+
+    private:
+        std::vector<std::shared_ptr<const Definition> > ordered;
+        std::unordered_set<std::string> ids;
+        std::shared_ptr<const Definition> last_added;
+    };
+
+    // Base class of gradients and patterns, which are painted by reference instead of by value.
+    class PaintServer {
+    public:
+        enum Units {
+            ObjectBoundingBox, UserSpaceOnUse
+        };
+
+        PaintServer(Units units) : units(units) {}
+
+        virtual ~PaintServer() {}
+
+        // Serialize the definition element with the given id.
+        virtual std::string definition(std::string const &id) const = 0;
+
+        virtual std::string fallbackColor() const { return "transparent"; }
+
+        // Snapshot of the paint server, identified by the hash of its content.
+        std::shared_ptr<const Definition> makeDefinition() const {
+            std::stringstream id;
+            id << "paint" << std::hex << hashString(definition(""));
+
+            std::shared_ptr<Definition> ret = std::make_shared<Definition>();
+            ret->id = id.str();
+            ret->content = definition(ret->id);
+            ret->fallback = fallbackColor();
+            ret->dependencies = dependencies;
+            return ret;
+        }
+
+    protected:
+        Units units;
+        std::vector<std::shared_ptr<const Definition> > dependencies;
+
+        std::string unitsString(std::string const &attribute_name) const {
+            return attribute(attribute_name, units == UserSpaceOnUse ? "userSpaceOnUse" : "objectBoundingBox");
+        }
+    };
+
+    // Color stop of a gradient, offset is in the range [0, 1].
+    struct Stop {
+        Stop(double offset, Color const &color, double opacity = 1)
+                : offset(offset), color(color), opacity(opacity) {}
+
+        std::string toString() const {
+            std::stringstream ss;
+            ss << "\t\t<stop " << attribute("offset", offset) << attribute("stop-color", color.toString());
+            if (opacity < 1)
+                ss << attribute("stop-opacity", opacity);
+            ss << emptyElemEnd();
+            return ss.str();
+        }
+
+        double offset;
+        Color color;
+        double opacity;
+    };
+
+    class Gradient : public PaintServer {
+    public:
+        Gradient(Units units) : PaintServer(units) {}
+
+        Gradient &operator<<(Stop const &stop) {
+            stops.push_back(stop);
+            return *this;
+        }
+
+        std::string fallbackColor() const {
+            return stops.empty() ? PaintServer::fallbackColor() : stops.front().color.toString();
+        }
+
+    protected:
+        std::vector<Stop> stops;
+    };
+
+    // Gradient coordinates default to the bounding box of the filled shape.
+    class LinearGradient : public Gradient {
+    public:
+        LinearGradient(Point const &start = Point(0, 0), Point const &end = Point(1, 0),
+                       Units units = ObjectBoundingBox)
+                : Gradient(units), start(start), end(end) {}
+
+        std::string definition(std::string const &id) const {
+            std::stringstream ss;
+            ss << elemStart("linearGradient") << attribute("id", id)
+               << attribute("x1", start.x) << attribute("y1", start.y)
+               << attribute("x2", end.x) << attribute("y2", end.y)
+               << unitsString("gradientUnits") << ">\n"
+               << vectorToString(stops) << "\t" << elemEnd("linearGradient");
+            return ss.str();
+        }
+
+    private:
+        Point start;
+        Point end;
+    };
+
+    class RadialGradient : public Gradient {
+    public:
+        RadialGradient(Point const &center = Point(.5, .5), double radius = .5,
+                       Units units = ObjectBoundingBox)
+                : Gradient(units), center(center), focal(center), radius(radius) {}
+
+        RadialGradient(Point const &center, double radius, Point const &focal,
+                       Units units = ObjectBoundingBox)
+                : Gradient(units), center(center), focal(focal), radius(radius) {}
+
+        std::string definition(std::string const &id) const {
+            std::stringstream ss;
+            ss << elemStart("radialGradient") << attribute("id", id)
+               << attribute("cx", center.x) << attribute("cy", center.y)
+               << attribute("r", radius)
+               << attribute("fx", focal.x) << attribute("fy", focal.y)
+               << unitsString("gradientUnits") << ">\n"
+               << vectorToString(stops) << "\t" << elemEnd("radialGradient");
+            return ss.str();
+        }
+
+    private:
+        Point center;
+        Point focal;
+        double radius;
+    };
+
     class Fill : public Serializeable {
     public:
         Fill(Color::Defaults color) : color(color) {}
@@ -307,14 +1096,31 @@ namespace svg {
         Fill(Color color = Color::Transparent)
                 : color(color) {}
 
+        // Gradients and patterns are snapshotted here, copies of the Fill share the definition.
+        Fill(PaintServer const &paint_server)
+                : color(Color::Transparent), paint(paint_server.makeDefinition()) {}
+
         std::string toString() const {
             std::stringstream ss;
-            ss << attribute("fill", color.toString());
+            if (paint)
+                ss << attribute("fill", "url(#" + paint->id + ")");
+            else
+                ss << attribute("fill", color.toString());
             return ss.str();
         }
 
+        void collectDefinitions(Definitions &definitions) const {
+            definitions.add(paint);
+        }
+
+        // CSS color of the fill, gradients and patterns are approximated by a plain color.
+        std::string colorString() const {
+            return paint ? paint->fallback : color.toString();
+        }
+
     private:
         Color color;
+        std::shared_ptr<const Definition> paint;
     };
 
     class Stroke : public Serializeable {
@@ -334,6 +1140,13 @@ namespace svg {
             return ss.str();
         }
 
+        // Negative when the shape is not stroked.
+        double strokeWidth() const { return width; }
+
+        std::string colorString() const { return color.toString(); }
+
+        bool isNonScaling() const { return nonScaling; }
+
     private:
         double width;
         Color color;
@@ -350,47 +1163,326 @@ namespace svg {
             return ss.str();
         }
 
+        std::size_t memoryUsage() const { return stringMemory(family); }
+
+        double fontSize() const { return size; }
+
+        // Font shorthand as used by CSS and the canvas API.
+        std::string cssString() const {
+            std::stringstream ss;
+            ss << size << "px " << family;
+            return ss.str();
+        }
+
     private:
         double size;
         std::string family;
     };
 
-    class Shape : public Serializeable {
+    class Shape;
+
+    // Compact scene for drawing on a <canvas> instead of building an SVG DOM.  Geometry goes
+    //  to flat numeric arrays that load straight into typed arrays, styles and fonts are
+    //  interned.  Each operation is an (command, style, count) triple consuming `count`
+    //  numbers of the data array.
+    class Scene {
     public:
-        Shape(Fill const &fill = Fill(), Stroke const &stroke = Stroke())
-                : fill(fill), stroke(stroke) {}
+        enum Command {
+            CircleCommand, EllipseCommand, RectangleCommand, LineCommand,
+            PolygonCommand, PolylineCommand, PathCommand, TextCommand, OpenPathCommand
+        };
 
-        virtual ~Shape() {}
+        Scene(std::string const &file_name) : file_name(file_name) {}
 
-        virtual std::string toString() const = 0;
+        Rect region;
 
-        virtual void offset(Point const &offset) = 0;
+        inline Scene &operator<<(Shape const &shape);
 
-        virtual Rect MinMax() const = 0;
+        void add(Command command, Fill const &fill, Stroke const &stroke,
+                 std::initializer_list<double> values) {
+            operation(command, fill, stroke, values.size());
+            data.insert(data.end(), values.begin(), values.end());
+        }
 
-    protected:
-        Fill fill;
-        Stroke stroke;
-    };
+        void add(Command command, Fill const &fill, Stroke const &stroke,
+                 std::vector<Point> const &points) {
+            operation(command, fill, stroke, points.size() * 2);
+            for (auto const &point : points) {
+                data.push_back(point.x);
+                data.push_back(point.y);
+            }
+        }
 
-    template<typename T>
-    std::string vectorToString(std::vector<T> collection, Layout const &layout) {
-        std::string combination_str;
-        for (unsigned i = 0; i < collection.size(); ++i)
-            combination_str += collection[i].toString();
+        // Sub-paths are stored as their point count followed by the points.
+        void addPath(Fill const &fill, Stroke const &stroke, std::vector<std::vector<Point> > const &paths,
+                     bool closed = true) {
+            std::size_t count = 0;
+            for (auto const &subpath : paths)
+                count += subpath.empty() ? 0 : 1 + subpath.size() * 2;
 
-        return combination_str;
-    }
+            operation(closed ? PathCommand : OpenPathCommand, fill, stroke, count);
+            for (auto const &subpath : paths) {
+                if (subpath.empty())
+                    continue;
 
-    template<typename T>
-    std::string vectorToString(std::vector<T> collection) {
-        std::string combination_str;
-        for (unsigned i = 0; i < collection.size(); ++i)
-            combination_str += collection[i].toString();
+                data.push_back(double(subpath.size()));
+                for (auto const &point : subpath) {
+                    data.push_back(point.x);
+                    data.push_back(point.y);
+                }
+            }
+        }
 
-        return combination_str;
+        void addText(Point const &origin, std::string const &content, Fill const &fill,
+                     Font const &font, Stroke const &stroke) {
+            operation(TextCommand, fill, stroke, 4);
+            data.push_back(origin.x);
+            data.push_back(origin.y);
+            data.push_back(double(intern(font.cssString(), font_index, fonts)));
+            data.push_back(double(texts.size()));
+            texts.push_back(content);
+        }
+
+        std::string toJson() const {
+            std::string ret = "{\"viewBox\":[";
+            appendNumber(ret, region.minPt.x);
+            ret += ",";
+            appendNumber(ret, region.minPt.y);
+            ret += ",";
+            appendNumber(ret, region.width());
+            ret += ",";
+            appendNumber(ret, region.height());
+            ret += "],\"styles\":[";
+            appendJoined(ret, styles);
+            ret += "],\"fonts\":[";
+            appendStrings(ret, fonts);
+            ret += "],\"texts\":[";
+            appendStrings(ret, texts);
+            ret += "],\"ops\":[";
+            ret.reserve(ret.size() + ops.size() * 3 + data.size() * 8);
+            for (std::size_t i = 0; i < ops.size(); ++i) {
+                if (i)
+                    ret += ",";
+                ret += std::to_string(ops[i]);
+            }
+            ret += "],\"data\":[";
+            for (std::size_t i = 0; i < data.size(); ++i) {
+                if (i)
+                    ret += ",";
+                // JSON has no representation for non-finite numbers.
+                if (data[i] - data[i] == 0)
+                    appendNumber(ret, data[i]);
+                else
+                    ret += "null";
+            }
+            return ret + "]}";
+        }
+
+        // Standalone page drawing the scene with the bundled renderer.
+        std::string toHtml() const {
+            std::stringstream ss;
+            ss << "<!DOCTYPE html>\n<html><body>\n<canvas id=\"scene\" "
+               << attribute("width", std::max(1.0, region.width()))
+               << attribute("height", std::max(1.0, region.height())) << "></canvas>\n<script>\n"
+               << renderer() << "renderScene(document.getElementById('scene'), " << toJson()
+               << ");\n</script>\n</body></html>\n";
+            return ss.str();
+        }
+
+        // Writes the standalone page when the file name ends in ".html", the JSON scene otherwise.
+        bool save() const {
+            std::ofstream ofs(file_name.c_str());
+            if (!ofs.good())
+                return false;
+
+            bool html = file_name.size() >= 5 && file_name.compare(file_name.size() - 5, 5, ".html") == 0;
+            ofs << (html ? toHtml() : toJson());
+            ofs.close();
+            return true;
+        }
+
+        // JavaScript function renderScene(canvas, scene) drawing a scene scaled to the canvas.
+        static std::string renderer() {
+            return
+                "function renderScene(canvas, s) {\n"
+                "  var ctx = canvas.getContext('2d'), v = s.viewBox;\n"
+                "  var k = Math.min(canvas.width / (v[2] || 1), canvas.height / (v[3] || 1));\n"
+                "  var ops = s.ops, d = Float64Array.from(s.data), p = 0;\n"
+                "  ctx.setTransform(k, 0, 0, k, -v[0] * k, -v[1] * k);\n"
+                "  for (var i = 0; i < ops.length; i += 3) {\n"
+                "    var c = ops[i], st = s.styles[ops[i + 1]], e = p + ops[i + 2], j, q, m;\n"
+                "    ctx.beginPath();\n"
+                "    if (c == 0) ctx.arc(d[p], d[p + 1], d[p + 2], 0, 2 * Math.PI);\n"
+                "    else if (c == 1) ctx.ellipse(d[p], d[p + 1], d[p + 2], d[p + 3], 0, 0, 2 * Math.PI);\n"
+                "    else if (c == 2) ctx.rect(d[p], d[p + 1], d[p + 2], d[p + 3]);\n"
+                "    else if (c == 3) { ctx.moveTo(d[p], d[p + 1]); ctx.lineTo(d[p + 2], d[p + 3]); }\n"
+                "    else if (c == 4 || c == 5) {\n"
+                "      for (j = p; j < e; j += 2) ctx.lineTo(d[j], d[j + 1]);\n"
+                "      if (c == 4) ctx.closePath();\n"
+                "    } else if (c == 6 || c == 8) {\n"
+                "      for (j = p; j < e; j += 2 * m) {\n"
+                "        m = d[j++];\n"
+                "        ctx.moveTo(d[j], d[j + 1]);\n"
+                "        for (q = 2; q < 2 * m; q += 2) ctx.lineTo(d[j + q], d[j + q + 1]);\n"
+                "        if (c == 6) ctx.closePath();\n"
+                "      }\n"
+                "    }\n"
+                "    if (c == 7) {\n"
+                "      ctx.font = s.fonts[d[p + 2]];\n"
+                "      ctx.fillStyle = st[0];\n"
+                "      ctx.fillText(s.texts[d[p + 3]], d[p], d[p + 1]);\n"
+                "    } else {\n"
+                "      if (st[0] != 'transparent') { ctx.fillStyle = st[0]; ctx.fill(c == 6 || c == 8 ? 'evenodd' : 'nonzero'); }\n"
+                "      if (st[2] >= 0) { ctx.lineWidth = st[3] ? st[2] / k : st[2]; ctx.strokeStyle = st[1]; ctx.stroke(); }\n"
+                "    }\n"
+                "    p = e;\n"
+                "  }\n"
+                "}\n";
+        }
+
+    private:
+        std::string file_name;
+        std::vector<int> ops;
+        std::vector<double> data;
+        std::vector<std::string> styles;
+        std::vector<std::string> fonts;
+        std::vector<std::string> texts;
+        std::unordered_map<std::string, int> style_index;
+        std::unordered_map<std::string, int> font_index;
+
+        void operation(Command command, Fill const &fill, Stroke const &stroke, std::size_t count) {
+            std::string style = "[" + quoted(fill.colorString()) + "," + quoted(stroke.colorString()) + ",";
+            appendNumber(style, stroke.strokeWidth());
+            style += stroke.isNonScaling() ? ",1]" : ",0]";
+
+            ops.push_back(command);
+            ops.push_back(intern(style, style_index, styles));
+            ops.push_back(int(count));
+        }
+
+        static int intern(std::string const &value, std::unordered_map<std::string, int> &index,
+                          std::vector<std::string> &values) {
+            auto inserted = index.insert(std::make_pair(value, int(values.size())));
+            if (inserted.second)
+                values.push_back(value);
+            return inserted.first->second;
+        }
+
+        static std::string quoted(std::string const &str) {
+            std::string ret = "\"";
+            for (char c : str) {
+                if (c == '"' || c == '\\')
+                    ret += '\\';
+                if (c == '/' && !ret.empty() && ret.back() == '<')
+                    ret += '\\';
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buffer[8];
+                    std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                    ret += buffer;
+                    continue;
+                }
+                ret += c;
+            }
+            return ret + "\"";
+        }
+
+        static void appendJoined(std::string &out, std::vector<std::string> const &values) {
+            for (std::size_t i = 0; i < values.size(); ++i) {
+                if (i)
+                    out += ",";
+                out += values[i];
+            }
+        }
+
+        static void appendStrings(std::string &out, std::vector<std::string> const &values) {
+            for (std::size_t i = 0; i < values.size(); ++i) {
+                if (i)
+                    out += ",";
+                out += quoted(values[i]);
+            }
+        }
+    };
+
+    class Shape : public Serializeable {
+    public:
+        Shape(Fill const &fill = Fill(), Stroke const &stroke = Stroke())
+                : fill(fill), stroke(stroke) {}
+
+        virtual ~Shape() {}
+
+        virtual std::string toString() const = 0;
+
+        virtual void offset(Point const &offset) = 0;
+
+        virtual Rect MinMax() const = 0;
+
+        // Gather the gradients and patterns this shape refers to.
+        virtual void collectDefinitions(Definitions &definitions) const {
+            fill.collectDefinitions(definitions);
+        }
+
+        // Append the shape to a canvas scene, shapes without a scene form are skipped.
+        virtual void toScene(Scene &) const {}
+
+        // Presentation attributes, which can be moved to an enclosing group.
+        virtual std::string styleString() const {
+            return fill.toString() + stroke.toString();
+        }
+
+        // The element without its styleString(), empty if the shape cannot be split that way.
+        virtual std::string bareString() const {
+            return "";
+        }
+
+        // Definitions are shared between shapes and accounted for by the document.
+        virtual MemoryUsage memoryUsage() const {
+            MemoryUsage ret;
+            ret.objects = sizeof(Shape);
+            return ret;
+        }
+
+    protected:
+        Fill fill;
+        Stroke stroke;
+    };
+
+    inline Scene &Scene::operator<<(Shape const &shape) {
+        shape.toScene(*this);
+        region.include(shape.MinMax());
+        return *this;
     }
 
+    // Tile of shapes repeated over the filled area.
+    class Pattern : public PaintServer {
+    public:
+        Pattern(Dimensions const &tile, Point const &origin = Point(0, 0), Units units = UserSpaceOnUse)
+                : PaintServer(units), tile(tile), origin(origin) {}
+
+        Pattern &operator<<(Shape const &shape) {
+            content += shape.toString();
+
+            shape.collectDefinitions(nested_definitions);
+            dependencies = nested_definitions.items();
+            return *this;
+        }
+
+        std::string definition(std::string const &id) const {
+            std::stringstream ss;
+            ss << elemStart("pattern") << attribute("id", id)
+               << attribute("x", origin.x) << attribute("y", origin.y)
+               << attribute("width", tile.width) << attribute("height", tile.height)
+               << unitsString("patternUnits") << ">\n"
+               << content << "\t" << elemEnd("pattern");
+            return ss.str();
+        }
+
+    private:
+        Dimensions tile;
+        Point origin;
+        std::string content;
+        Definitions nested_definitions;
+    };
+
     class Circle : public Shape {
     public:
         Circle(Point const &center, double diameter, Fill const &fill,
@@ -398,12 +1490,11 @@ namespace svg {
                 : Shape(fill, stroke), center(center), radius(diameter / 2) {}
 
         std::string toString() const {
-            std::stringstream ss;
-            ss << elemStart("circle") << attribute("cx", center.x)
-               << attribute("cy", center.y)
-               << attribute("r", radius) << fill.toString()
-               << stroke.toString() << emptyElemEnd();
-            return ss.str();
+            return element(styleString());
+        }
+
+        std::string bareString() const {
+            return element("");
         }
 
         void offset(Point const &offset) {
@@ -414,7 +1505,25 @@ namespace svg {
         virtual Rect MinMax() const {
             return Rect(Point(center.x - radius, center.y - radius), radius * 2.0, radius * 2.0);
         };
+
+        void toScene(Scene &scene) const {
+            scene.add(Scene::CircleCommand, fill, stroke, {center.x, center.y, radius});
+        }
+
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret;
+            ret.objects = sizeof(*this);
+            return ret;
+        }
     private:
+        std::string element(std::string const &style) const {
+            std::stringstream ss;
+            ss << elemStart("circle") << attribute("cx", center.x)
+               << attribute("cy", center.y)
+               << attribute("r", radius) << style << emptyElemEnd();
+            return ss.str();
+        }
+
         Point center;
         double radius;
     };
@@ -427,13 +1536,11 @@ namespace svg {
                   radius_height(height / 2) {}
 
         std::string toString() const {
-            std::stringstream ss;
-            ss << elemStart("ellipse") << attribute("cx", center.x)
-               << attribute("cy", center.y)
-               << attribute("rx", radius_width)
-               << attribute("ry", radius_height)
-               << fill.toString() << stroke.toString() << emptyElemEnd();
-            return ss.str();
+            return element(styleString());
+        }
+
+        std::string bareString() const {
+            return element("");
         }
 
         void offset(Point const &offset) {
@@ -444,7 +1551,27 @@ namespace svg {
         virtual Rect MinMax() const {
             return Rect(Point(center.x - radius_width, center.y - radius_height), radius_width * 2, radius_height * 2);
         };
+
+        void toScene(Scene &scene) const {
+            scene.add(Scene::EllipseCommand, fill, stroke, {center.x, center.y, radius_width, radius_height});
+        }
+
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret;
+            ret.objects = sizeof(*this);
+            return ret;
+        }
     private:
+        std::string element(std::string const &style) const {
+            std::stringstream ss;
+            ss << elemStart("ellipse") << attribute("cx", center.x)
+               << attribute("cy", center.y)
+               << attribute("rx", radius_width)
+               << attribute("ry", radius_height)
+               << style << emptyElemEnd();
+            return ss.str();
+        }
+
         Point center;
         double radius_width;
         double radius_height;
@@ -458,13 +1585,11 @@ namespace svg {
                   height(height) {}
 
         std::string toString() const {
-            std::stringstream ss;
-            ss << elemStart("rect") << attribute("x", edge.x)
-               << attribute("y", edge.y)
-               << attribute("width", width)
-               << attribute("height", height)
-               << fill.toString() << stroke.toString() << emptyElemEnd();
-            return ss.str();
+            return element(styleString());
+        }
+
+        std::string bareString() const {
+            return element("");
         }
 
         void offset(Point const &offset) {
@@ -475,7 +1600,27 @@ namespace svg {
         virtual Rect MinMax() const {
             return Rect(edge, width, height);
         };
+
+        void toScene(Scene &scene) const {
+            scene.add(Scene::RectangleCommand, fill, stroke, {edge.x, edge.y, width, height});
+        }
+
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret;
+            ret.objects = sizeof(*this);
+            return ret;
+        }
     private:
+        std::string element(std::string const &style) const {
+            std::stringstream ss;
+            ss << elemStart("rect") << attribute("x", edge.x)
+               << attribute("y", edge.y)
+               << attribute("width", width)
+               << attribute("height", height)
+               << style << emptyElemEnd();
+            return ss.str();
+        }
+
         Point edge;
         double width;
         double height;
@@ -489,13 +1634,15 @@ namespace svg {
                   end_point(end_point) {}
 
         std::string toString() const {
-            std::stringstream ss;
-            ss << elemStart("line") << attribute("x1", start_point.x)
-               << attribute("y1", start_point.y)
-               << attribute("x2", end_point.x)
-               << attribute("y2", end_point.y)
-               << stroke.toString() << emptyElemEnd();
-            return ss.str();
+            return element(styleString());
+        }
+
+        std::string bareString() const {
+            return element("");
+        }
+
+        std::string styleString() const {
+            return stroke.toString();
         }
 
         void offset(Point const &offset) {
@@ -511,7 +1658,27 @@ namespace svg {
             rtn.include(end_point);
             return rtn;
         };
+
+        void toScene(Scene &scene) const {
+            scene.add(Scene::LineCommand, fill, stroke, {start_point.x, start_point.y, end_point.x, end_point.y});
+        }
+
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret;
+            ret.objects = sizeof(*this);
+            return ret;
+        }
     private:
+        std::string element(std::string const &style) const {
+            std::stringstream ss;
+            ss << elemStart("line") << attribute("x1", start_point.x)
+               << attribute("y1", start_point.y)
+               << attribute("x2", end_point.x)
+               << attribute("y2", end_point.y)
+               << style << emptyElemEnd();
+            return ss.str();
+        }
+
         Point start_point;
         Point end_point;
     };
@@ -529,16 +1696,11 @@ namespace svg {
         }
 
         std::string toString() const {
-            std::stringstream ss;
-            ss << elemStart("polygon");
-
-            ss << "points=\"";
-            for (unsigned i = 0; i < points.size(); ++i)
-                ss << points[i].x << "," << points[i].y << " ";
-            ss << "\" ";
+            return element(styleString());
+        }
 
-            ss << fill.toString() << stroke.toString() << emptyElemEnd();
-            return ss.str();
+        std::string bareString() const {
+            return element("");
         }
 
         void offset(Point const &offset) {
@@ -549,16 +1711,35 @@ namespace svg {
         }
 
         virtual Rect MinMax() const {
-            if (points.empty())
-                return Rect();
-
-            Rect rtn(points.front());
-            for (auto &pt : points)
-                rtn.include(pt);
+            Rect rtn;
+            finiteBounds(points, rtn);
             return rtn;
         }
 
+        void toScene(Scene &scene) const {
+            scene.add(Scene::PolygonCommand, fill, stroke, points);
+        }
+
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret;
+            ret.objects = sizeof(*this);
+            ret.points = vectorMemory(points);
+            return ret;
+        }
+
     private:
+        std::string element(std::string const &style) const {
+            std::string ret = elemStart("polygon");
+            ret.reserve(ret.size() + points.size() * 12 + 96);
+
+            ret += "points=\"";
+            appendPoints(ret, points);
+            ret += "\" ";
+
+            ret += style + emptyElemEnd();
+            return ret;
+        }
+
         std::vector<Point> points;
     };
 
@@ -579,25 +1760,39 @@ namespace svg {
                 paths.emplace_back();
         }
 
-        std::string toString() const {
-            std::stringstream ss;
-            ss << elemStart("path");
+        // Open sub-paths are not joined back to their first point.
+        void setClosed(bool closed_paths) {
+            closed = closed_paths;
+        }
 
-            ss << "d=\"";
-            for (auto const &subpath: paths) {
-                if (subpath.empty())
-                    continue;
+        // Open path through a series, each run of finite points becomes a sub-path so that
+        //  NaN or infinite samples leave gaps.  Runs are copied in bulk.
+        static Path fromSeries(std::vector<Point> const &points, Stroke const &stroke = Stroke()) {
+            return fromSeries(points, Fill(), stroke);
+        }
 
-                ss << "M";
-                for (auto const &point: subpath)
-                    ss << point.x << "," << point.y << " ";
-                ss << "z ";
-            }
-            ss << "\" ";
-            ss << "fill-rule=\"evenodd\" ";
+        static Path fromSeries(std::vector<Point> const &points, Fill const &fill, Stroke const &stroke) {
+            Path path(fill, stroke);
+            path.closed = false;
+            path.paths.clear();
 
-            ss << fill.toString() << stroke.toString() << emptyElemEnd();
-            return ss.str();
+            bool gaps = !points.empty() && forEachFiniteRun(&points[0], points.size(),
+                    [&](std::size_t begin, std::size_t end) {
+                path.paths.emplace_back(points.begin() + begin, points.begin() + end);
+            });
+            if (!gaps)
+                path.paths.push_back(points);
+
+            path.startNewSubPath();
+            return path;
+        }
+
+        std::string toString() const {
+            return element(styleString());
+        }
+
+        std::string bareString() const {
+            return element("");
         }
 
         void offset(Point const &offset) {
@@ -609,18 +1804,57 @@ namespace svg {
         }
 
         virtual Rect MinMax() const {
-            if (paths.empty())
-                return Rect();
+            Rect rtn;
+            bool found = false;
+            for (auto const &path : paths) {
+                Rect bounds;
+                if (!finiteBounds(path, bounds))
+                    continue;
 
-            Rect rtn(paths.front().front());
-            for (auto &path : paths) {
-                for (auto &pt : path)
-                    rtn.include(pt);
+                if (found)
+                    rtn.include(bounds);
+                else
+                    rtn = bounds;
+                found = true;
             }
             return rtn;
         };
+
+        void toScene(Scene &scene) const {
+            scene.addPath(fill, stroke, paths, closed);
+        }
+
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret;
+            ret.objects = sizeof(*this);
+            ret.buffers = vectorMemory(paths);
+            for (auto const &subpath : paths)
+                ret.points += vectorMemory(subpath);
+            return ret;
+        }
     private:
+        std::string element(std::string const &style) const {
+            std::string ret = elemStart("path");
+
+            ret += "d=\"";
+            for (auto const &subpath: paths) {
+                if (subpath.empty())
+                    continue;
+
+                ret += "M";
+                appendPoints(ret, subpath);
+                if (closed)
+                    ret += "z ";
+            }
+            ret += "\" ";
+            ret += "fill-rule=\"evenodd\" ";
+
+            ret += style + emptyElemEnd();
+            return ret;
+        }
+
         std::vector<std::vector<Point>> paths;
+        bool closed = true;
     };
 
     class Polyline : public Shape {
@@ -640,16 +1874,11 @@ namespace svg {
         }
 
         std::string toString() const {
-            std::stringstream ss;
-            ss << elemStart("polyline");
-
-            ss << "points=\"";
-            for (unsigned i = 0; i < points.size(); ++i)
-                ss << points[i].x << "," << points[i].y << " ";
-            ss << "\" ";
+            return element(styleString());
+        }
 
-            ss << fill.toString() << stroke.toString() << emptyElemEnd();
-            return ss.str();
+        std::string bareString() const {
+            return element("");
         }
 
         void offset(Point const &offset) {
@@ -660,214 +1889,4277 @@ namespace svg {
         }
 
         virtual Rect MinMax() const {
-            if (points.empty())
-                return Rect();
-
-            Rect rtn(points.front());
-            for (auto &pt : points)
-                rtn.include(pt);
+            Rect rtn;
+            finiteBounds(points, rtn);
             return rtn;
         }
 
+        // Series with gaps are drawn as an open path with one sub-path per run.
+        void toScene(Scene &scene) const {
+            if (std::all_of(points.begin(), points.end(), isFinite))
+                scene.add(Scene::PolylineCommand, fill, stroke, points);
+            else
+                toPath().toScene(scene);
+        }
+
+        // Open path with the same style, NaN or infinite points leave gaps.
+        Path toPath() const {
+            return Path::fromSeries(points, fill, stroke);
+        }
+
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret;
+            ret.objects = sizeof(*this);
+            ret.points = vectorMemory(points);
+            return ret;
+        }
+
         std::vector<Point> points;
+
+    private:
+        // NaN or infinite points split the line, each run of finite points is written as its
+        //  own <polyline> so that gaps are not bridged.
+        std::string element(std::string const &style) const {
+            std::string ret;
+            bool gaps = !points.empty() && forEachFiniteRun(&points[0], points.size(),
+                    [&](std::size_t begin, std::size_t end) {
+                appendElement(ret, &points[begin], end - begin, style);
+            });
+            if (!gaps)
+                appendElement(ret, points.data(), points.size(), style);
+            return ret;
+        }
+
+        void appendElement(std::string &out, Point const *run, std::size_t count, std::string const &style) const {
+            out += elemStart("polyline");
+            out.reserve(out.size() + count * 12 + 96);
+
+            out += "points=\"";
+            appendPoints(out, run, count);
+            out += "\" ";
+
+            out += style + emptyElemEnd();
+        }
     };
 
-    class Text : public Shape {
+    // Polyline in polar coordinates around a center, e.g. for radar plots and antenna
+    //  patterns.  Radii and angles (radians, counterclockwise from the x axis in a bottom
+    //  left layout) are kept as separate arrays and converted in blocks while serializing,
+    //  so no Cartesian copy of the points is stored.  Closed lines are written as polygons.
+    class PolarPolyline : public Shape {
     public:
-        Text(Point const &origin, std::string const &content, Fill const &fill = Fill(),
-             Font const &font = Font(), Stroke const &stroke = Stroke())
-                : Shape(fill, stroke), origin(origin), content(content), font(font) {}
+        PolarPolyline(Point const &center, Fill const &fill = Fill(), Stroke const &stroke = Stroke())
+                : Shape(fill, stroke), center(center) {}
+
+        PolarPolyline(Point const &center, Stroke const &stroke) : Shape(Color::Transparent, stroke), center(center) {}
+
+        PolarPolyline(Point const &center, std::vector<double> const &radii, std::vector<double> const &angles,
+                      Fill const &fill = Fill(), Stroke const &stroke = Stroke())
+                : Shape(fill, stroke), center(center), radii(radii), angles(angles) {
+            this->radii.resize(std::min(radii.size(), angles.size()));
+            this->angles.resize(this->radii.size());
+        }
+
+        PolarPolyline &add(double radius, double angle) {
+            radii.push_back(radius);
+            angles.push_back(angle);
+            return *this;
+        }
+
+        void setClosed(bool closed_line) {
+            closed = closed_line;
+        }
 
         std::string toString() const {
-            std::stringstream ss;
-            ss << elemStart("text") << attribute("x", origin.x)
-               << attribute("y", origin.y)
-               << fill.toString() << stroke.toString() << font.toString()
-               << ">" << content << elemEnd("text");
-            return ss.str();
+            return element(styleString());
+        }
+
+        std::string bareString() const {
+            return element("");
         }
 
         void offset(Point const &offset) {
-            origin.x += offset.x;
-            origin.y += offset.y;
+            center.x += offset.x;
+            center.y += offset.y;
         }
 
         virtual Rect MinMax() const {
-            Rect rtn(origin);
+            Rect rtn;
+            bool found = false;
+            forEachBlock([&](Point const *points, std::size_t count) {
+                Rect bounds;
+                if (!finiteBounds(points, count, bounds))
+                    return;
+
+                if (found)
+                    rtn.include(bounds);
+                else
+                    rtn = bounds;
+                found = true;
+            });
             return rtn;
         }
 
+        void toScene(Scene &scene) const {
+            std::vector<Point> points;
+            points.reserve(radii.size());
+            forEachBlock([&](Point const *block, std::size_t count) {
+                points.insert(points.end(), block, block + count);
+            });
+            scene.add(closed ? Scene::PolygonCommand : Scene::PolylineCommand, fill, stroke, points);
+        }
+
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret;
+            ret.objects = sizeof(*this);
+            ret.points = vectorMemory(radii) + vectorMemory(angles);
+            return ret;
+        }
+
+        Point center;
+        std::vector<double> radii;
+        std::vector<double> angles;
+
     private:
-        Point origin;
-        std::string content;
-        Font font;
+        bool closed = false;
+
+        // Calls fn(points, count) with consecutive blocks of Cartesian points.
+        template<typename F>
+        void forEachBlock(F const &fn) const {
+            static const std::size_t block_size = 256;
+            double sines[block_size], cosines[block_size];
+            Point points[block_size];
+
+            std::size_t count = std::min(radii.size(), angles.size());
+            for (std::size_t begin = 0; begin < count; begin += block_size) {
+                std::size_t n = std::min(block_size, count - begin);
+                sinCos(&angles[begin], n, sines, cosines);
+                for (std::size_t i = 0; i < n; ++i)
+                    points[i] = Point(center.x + radii[begin + i] * cosines[i],
+                                      center.y + radii[begin + i] * sines[i]);
+                fn(points, n);
+            }
+        }
+
+        std::string element(std::string const &style) const {
+            std::string ret = elemStart(closed ? "polygon" : "polyline");
+            ret.reserve(ret.size() + radii.size() * 16 + 96);
+
+            ret += "points=\"";
+            forEachBlock([&](Point const *points, std::size_t count) {
+                appendPoints(ret, points, count);
+            });
+            ret += "\" ";
+
+            ret += style + emptyElemEnd();
+            return ret;
+        }
     };
 
-    // Sample charting class.
-    class LineChart : public Shape {
+    // Base of shapes holding many primitives in columnar arrays instead of one object each.
+    //  Style 0 is the fill and stroke of the batch, addStyle() extends the palette.  Style
+    //  indices are only stored once an element uses a style other than 0.
+    class BatchShape : public Shape {
     public:
-        LineChart(Dimensions margin = Dimensions(), double scale = 1,
-                  Stroke const &axis_stroke = Stroke(.5, Color::Purple))
-                : axis_stroke(axis_stroke), margin(margin), scale(scale) {}
+        // Returns the index to pass when adding elements.
+        std::uint32_t addStyle(Fill const &style_fill, Stroke const &style_stroke = Stroke()) {
+            palette.push_back(Style{style_fill, style_stroke});
+            return std::uint32_t(palette.size());
+        }
 
-        LineChart &operator<<(Polyline const &polyline) {
-            if (polyline.points.empty())
-                return *this;
+        void collectDefinitions(Definitions &definitions) const {
+            Shape::collectDefinitions(definitions);
+            for (auto const &style : palette)
+                style.fill.collectDefinitions(definitions);
+        }
 
-            polylines.push_back(polyline);
+    protected:
+        BatchShape(Fill const &fill, Stroke const &stroke) : Shape(fill, stroke) {}
+
+        struct Style {
+            Fill fill;
+            Stroke stroke;
+        };
+
+        std::vector<Style> palette;
+        std::vector<std::uint32_t> style_indices;
+
+        // Record the style of element `index`, which is being appended.
+        void pushStyle(std::uint32_t style, std::size_t index) {
+            if (style > palette.size())
+                throw std::out_of_range("svg::BatchShape: unknown style");
+            if (style != 0 && style_indices.empty())
+                style_indices.assign(index, 0);
+            if (!style_indices.empty())
+                style_indices.push_back(style);
+        }
+
+        std::uint32_t styleOf(std::size_t index) const {
+            return style_indices.empty() ? 0 : style_indices[index];
+        }
+
+        Fill const &fillOf(std::uint32_t style) const { return style == 0 ? fill : palette[style - 1].fill; }
+
+        Stroke const &strokeOf(std::uint32_t style) const { return style == 0 ? stroke : palette[style - 1].stroke; }
+
+        std::string paletteString(std::uint32_t style) const {
+            return fillOf(style).toString() + strokeOf(style).toString();
+        }
+
+        // Writes elements in drawing order, runs of one style share a <g> carrying it.  Styles
+        //  with vector-effect, which is not inherited, are passed on to each element instead.
+        //  element(out, index, style) appends one element.
+        template<typename F>
+        void appendElements(std::string &out, std::size_t count, F const &element) const {
+            std::string style;
+            bool grouped = false;
+            for (std::size_t i = 0; i < count; ++i) {
+                if (i == 0 || styleOf(i) != styleOf(i - 1)) {
+                    if (grouped)
+                        out += elemEnd("g");
+                    style = paletteString(styleOf(i));
+                    grouped = style.find("vector-effect") == std::string::npos;
+                    if (grouped) {
+                        out += elemStart("g") + style + ">\n";
+                        style.clear();
+                    }
+                }
+                element(out, i, style);
+            }
+            if (grouped)
+                out += elemEnd("g");
+        }
+
+        // Writes one <path> per style, subpath(out, index, first) appends the commands of an
+        //  element, `first` is set for the first element of each path.  Elements are ordered by
+        //  style, drawing order is kept within a style.
+        template<typename F>
+        void appendPaths(std::string &out, std::size_t count, F const &subpath) const {
+            if (count == 0)
+                return;
+
+            if (style_indices.empty()) {
+                appendPath(out, 0, [&](std::size_t i, bool first) { subpath(out, i, first); }, 0, count);
+                return;
+            }
+
+            // Counting sort by style.
+            std::vector<std::size_t> starts(palette.size() + 2, 0);
+            for (auto style : style_indices)
+                ++starts[style + 1];
+            for (std::size_t style = 1; style < starts.size(); ++style)
+                starts[style] += starts[style - 1];
+
+            std::vector<std::uint32_t> order(count);
+            std::vector<std::size_t> cursors(starts.begin(), starts.end() - 1);
+            for (std::size_t i = 0; i < count; ++i)
+                order[cursors[style_indices[i]]++] = std::uint32_t(i);
+
+            for (std::size_t style = 0; style + 1 < starts.size(); ++style)
+                appendPath(out, std::uint32_t(style), [&](std::size_t i, bool first) { subpath(out, order[i], first); },
+                           starts[style], starts[style + 1]);
+        }
+
+        template<typename F>
+        void appendPath(std::string &out, std::uint32_t style, F const &subpath, std::size_t begin,
+                        std::size_t end) const {
+            if (begin == end)
+                return;
+
+            out += elemStart("path");
+            out += "d=\"";
+            for (std::size_t i = begin; i < end; ++i)
+                subpath(i, i == begin);
+            out += "\" ";
+            out += paletteString(style) + emptyElemEnd();
+        }
+
+        // Bounds over the elements that are drawn.  extent(axis, begin, n, lower, upper) writes
+        //  the lower and upper edges of elements [begin, begin + n) along an axis, and elements
+        //  for which finite(index) is false are left out on both axes, as when writing them.
+        template<typename F, typename G>
+        Rect batchBounds(std::size_t count, F const &extent, G const &finite) const {
+            static const std::size_t block_size = 256;
+            double lower[block_size], upper[block_size], gaps[block_size];
+            double min[2] = {HUGE_VAL, HUGE_VAL}, max[2] = {-HUGE_VAL, -HUGE_VAL};
+            double nan = std::numeric_limits<double>::quiet_NaN();
+            for (std::size_t begin = 0; begin < count; begin += block_size) {
+                std::size_t n = std::min(block_size, count - begin);
+                for (std::size_t i = 0; i < n; ++i)
+                    gaps[i] = finite(begin + i) ? 0.0 : nan;
+                for (int axis = 0; axis < 2; ++axis) {
+                    double lo, hi;
+                    extent(axis, begin, n, lower, upper);
+                    for (std::size_t i = 0; i < n; ++i) {
+                        lower[i] += gaps[i];
+                        upper[i] += gaps[i];
+                    }
+                    if (!minMax(lower, upper, n, lo, hi))
+                        continue;
+
+                    min[axis] = std::min(min[axis], lo);
+                    max[axis] = std::max(max[axis], hi);
+                }
+            }
+
+            Rect rtn;
+            if (min[0] <= max[0] && min[1] <= max[1]) {
+                rtn.minPt = Point(min[0], min[1]);
+                rtn.maxPt = Point(max[0], max[1]);
+            }
+            return rtn;
+        }
+
+        MemoryUsage batchMemoryUsage() const {
+            MemoryUsage ret;
+            ret.objects = sizeof(*this);
+            ret.buffers = vectorMemory(palette) + vectorMemory(style_indices);
+            return ret;
+        }
+    };
+
+    // Any number of circles in columnar arrays, for bubble charts and scatter plots with
+    //  millions of marks.  Circles are written as <circle> elements, or with Arcs output as
+    //  one path per style made of two half circle arcs each, which leaves the browser a
+    //  handful of DOM nodes instead of millions.  Circles with non-finite values are skipped.
+    class CircleBatch : public BatchShape {
+    public:
+        enum Output {
+            Elements, Arcs
+        };
+
+        CircleBatch(Fill const &fill = Fill(), Stroke const &stroke = Stroke(), Output output = Elements)
+                : BatchShape(fill, stroke), output(output) {}
+
+        // As with Circle, the size is given as the diameter.
+        CircleBatch &add(Point const &center, double diameter, std::uint32_t style = 0) {
+            pushStyle(style, xs.size());
+            xs.push_back(center.x);
+            ys.push_back(center.y);
+            radii.push_back(diameter / 2);
             return *this;
         }
 
-        std::string toString() const {
-            if (polylines.empty())
-                return "";
+        CircleBatch &add(double const *cx, double const *cy, double const *diameters, std::size_t count,
+                         std::uint32_t style = 0) {
+            reserve(xs.size() + count);
+            for (std::size_t i = 0; i < count; ++i) {
+                pushStyle(style, xs.size() + i);
+                radii.push_back(diameters[i] / 2);
+            }
+            xs.insert(xs.end(), cx, cx + count);
+            ys.insert(ys.end(), cy, cy + count);
+            return *this;
+        }
+
+        void reserve(std::size_t count) {
+            xs.reserve(count);
+            ys.reserve(count);
+            radii.reserve(count);
+        }
+
+        std::size_t size() const { return xs.size(); }
+
+        CircleBatch &setOutput(Output batch_output) {
+            output = batch_output;
+            return *this;
+        }
 
+        std::string toString() const {
             std::string ret;
-            for (unsigned i = 0; i < polylines.size(); ++i)
-                ret += polylineToString(polylines[i]);
+            ret.reserve(xs.size() * (output == Elements ? 48 : 40));
+            if (output == Elements)
+                appendElements(ret, xs.size(), [this](std::string &out, std::size_t i, std::string const &style) {
+                    if (!finite(i))
+                        return;
+
+                    out += "\t<circle cx=\"";
+                    appendNumber(out, xs[i]);
+                    out += "\" cy=\"";
+                    appendNumber(out, ys[i]);
+                    out += "\" r=\"";
+                    appendNumber(out, radii[i]);
+                    out += "\" ";
+                    out += style;
+                    out += emptyElemEnd();
+                });
+            else
+                appendPaths(ret, xs.size(), [this](std::string &out, std::size_t i, bool) {
+                    if (!finite(i))
+                        return;
+
+                    out += 'M';
+                    appendNumber(out, xs[i] - radii[i]);
+                    out += ',';
+                    appendNumber(out, ys[i]);
+                    out += "a";
+                    appendNumber(out, radii[i]);
+                    out += ',';
+                    appendNumber(out, radii[i]);
+                    out += " 0 1,0 ";
+                    appendNumber(out, radii[i] * 2);
+                    out += ",0a";
+                    appendNumber(out, radii[i]);
+                    out += ',';
+                    appendNumber(out, radii[i]);
+                    out += " 0 1,0 ";
+                    appendNumber(out, -radii[i] * 2);
+                    out += ",0";
+                });
+            return ret;
+        }
 
-            return ret + axisString();
+        void offset(Point const &offset) {
+            for (auto &x : xs)
+                x += offset.x;
+            for (auto &y : ys)
+                y += offset.y;
+        }
+
+        virtual Rect MinMax() const {
+            return batchBounds(xs.size(), [this](int axis, std::size_t begin, std::size_t n, double *lower, double *upper) {
+                double const *centers = (axis == 0 ? xs.data() : ys.data()) + begin;
+                for (std::size_t i = 0; i < n; ++i) {
+                    lower[i] = centers[i] - radii[begin + i];
+                    upper[i] = centers[i] + radii[begin + i];
+                }
+            }, [this](std::size_t i) { return finite(i); });
+        }
+
+        void toScene(Scene &scene) const {
+            for (std::size_t i = 0; i < xs.size(); ++i)
+                if (finite(i))
+                    scene.add(Scene::CircleCommand, fillOf(styleOf(i)), strokeOf(styleOf(i)), {xs[i], ys[i], radii[i]});
+        }
+
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret = batchMemoryUsage();
+            ret.objects = sizeof(*this);
+            ret.points = vectorMemory(xs) + vectorMemory(ys) + vectorMemory(radii);
+            return ret;
+        }
+
+    private:
+        std::vector<double> xs, ys, radii;
+        Output output;
+
+        bool finite(std::size_t i) const {
+            return (xs[i] - xs[i] == 0) & (ys[i] - ys[i] == 0) & (radii[i] - radii[i] == 0);
+        }
+    };
+
+    // Any number of axis aligned rectangles in columnar arrays, for Gantt charts, timelines
+    //  and treemaps.  Rectangles are written as <rect> elements, or with Paths output as one
+    //  path per style of "M x,y h w v h h -w z" subpaths.  Rectangles with non-finite values
+    //  are skipped, negative sizes extend a rectangle left or up from its edge.
+    class RectangleBatch : public BatchShape {
+    public:
+        enum Output {
+            Elements, Paths
+        };
+
+        RectangleBatch(Fill const &fill = Fill(), Stroke const &stroke = Stroke(), Output output = Paths)
+                : BatchShape(fill, stroke), output(output) {}
+
+        RectangleBatch &add(Point const &edge, double width, double height, std::uint32_t style = 0) {
+            pushStyle(style, xs.size());
+            xs.push_back(edge.x);
+            ys.push_back(edge.y);
+            widths.push_back(width);
+            heights.push_back(height);
+            normalize(xs.size() - 1);
+            return *this;
+        }
+
+        RectangleBatch &add(double const *x, double const *y, double const *width, double const *height,
+                            std::size_t count, std::uint32_t style = 0) {
+            for (std::size_t i = 0; i < count; ++i)
+                pushStyle(style, xs.size() + i);
+            xs.insert(xs.end(), x, x + count);
+            ys.insert(ys.end(), y, y + count);
+            widths.insert(widths.end(), width, width + count);
+            heights.insert(heights.end(), height, height + count);
+            normalize(xs.size() - count);
+            return *this;
+        }
+
+        void reserve(std::size_t count) {
+            xs.reserve(count);
+            ys.reserve(count);
+            widths.reserve(count);
+            heights.reserve(count);
+        }
+
+        std::size_t size() const { return xs.size(); }
+
+        RectangleBatch &setOutput(Output batch_output) {
+            output = batch_output;
+            return *this;
+        }
+
+        std::string toString() const {
+            std::string ret;
+            ret.reserve(xs.size() * (output == Elements ? 56 : 28));
+            if (output == Elements)
+                appendElements(ret, xs.size(), [this](std::string &out, std::size_t i, std::string const &style) {
+                    if (!finite(i))
+                        return;
+
+                    out += "\t<rect x=\"";
+                    appendNumber(out, xs[i]);
+                    out += "\" y=\"";
+                    appendNumber(out, ys[i]);
+                    out += "\" width=\"";
+                    appendNumber(out, widths[i]);
+                    out += "\" height=\"";
+                    appendNumber(out, heights[i]);
+                    out += "\" ";
+                    out += style;
+                    out += emptyElemEnd();
+                });
+            else
+                appendPaths(ret, xs.size(), [this](std::string &out, std::size_t i, bool) {
+                    if (!finite(i))
+                        return;
+
+                    out += 'M';
+                    appendNumber(out, xs[i]);
+                    out += ',';
+                    appendNumber(out, ys[i]);
+                    out += 'h';
+                    appendNumber(out, widths[i]);
+                    out += 'v';
+                    appendNumber(out, heights[i]);
+                    out += 'h';
+                    appendNumber(out, -widths[i]);
+                    out += 'z';
+                });
+            return ret;
         }
 
         void offset(Point const &offset) {
-            for (unsigned i = 0; i < polylines.size(); ++i)
-                polylines[i].offset(offset);
+            for (auto &x : xs)
+                x += offset.x;
+            for (auto &y : ys)
+                y += offset.y;
         }
 
         virtual Rect MinMax() const {
-            Rect rtn;
-            return rtn;
+            return batchBounds(xs.size(), [this](int axis, std::size_t begin, std::size_t n, double *lower, double *upper) {
+                double const *edges = (axis == 0 ? xs.data() : ys.data()) + begin;
+                double const *sizes = (axis == 0 ? widths.data() : heights.data()) + begin;
+                for (std::size_t i = 0; i < n; ++i) {
+                    lower[i] = edges[i];
+                    upper[i] = edges[i] + sizes[i];
+                }
+            }, [this](std::size_t i) { return finite(i); });
+        }
+
+        void toScene(Scene &scene) const {
+            for (std::size_t i = 0; i < xs.size(); ++i)
+                if (finite(i))
+                    scene.add(Scene::RectangleCommand, fillOf(styleOf(i)), strokeOf(styleOf(i)),
+                              {xs[i], ys[i], widths[i], heights[i]});
+        }
+
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret = batchMemoryUsage();
+            ret.objects = sizeof(*this);
+            ret.points = vectorMemory(xs) + vectorMemory(ys) + vectorMemory(widths) + vectorMemory(heights);
+            return ret;
         }
 
     private:
-        Stroke axis_stroke;
-        Dimensions margin;
-        double scale;
-        std::vector<Polyline> polylines;
+        std::vector<double> xs, ys, widths, heights;
+        Output output;
 
-        optional<Dimensions> getDimensions() const {
-            if (polylines.empty())
-                return optional<Dimensions>();
+        bool finite(std::size_t i) const {
+            return (xs[i] - xs[i] == 0) & (ys[i] - ys[i] == 0) & (widths[i] - widths[i] == 0)
+                   & (heights[i] - heights[i] == 0);
+        }
 
-            optional<Point> min = getMinPoint(polylines[0].points);
-            optional<Point> max = getMaxPoint(polylines[0].points);
-            for (unsigned i = 0; i < polylines.size(); ++i) {
-                if (getMinPoint(polylines[i].points)->x < min->x)
-                    min->x = getMinPoint(polylines[i].points)->x;
-                if (getMinPoint(polylines[i].points)->y < min->y)
-                    min->y = getMinPoint(polylines[i].points)->y;
-                if (getMaxPoint(polylines[i].points)->x > max->x)
-                    max->x = getMaxPoint(polylines[i].points)->x;
-                if (getMaxPoint(polylines[i].points)->y > max->y)
-                    max->y = getMaxPoint(polylines[i].points)->y;
+        // Stores rectangles from `begin` on with non-negative sizes, so that <rect> elements,
+        //  paths and bounds agree.
+        void normalize(std::size_t begin) {
+            for (std::size_t i = begin; i < xs.size(); ++i) {
+                double width = widths[i], height = heights[i];
+                xs[i] += std::min(width, 0.0);
+                ys[i] += std::min(height, 0.0);
+                widths[i] = std::fabs(width);
+                heights[i] = std::fabs(height);
             }
+        }
+    };
+
+    // Any number of line segments in flat endpoint arrays, e.g. the edges of a network
+    //  diagram.  Segments of one style form a single <path> of relative "m dx,dy l dx,dy"
+    //  commands.  Endpoints are rounded to a fixed number of decimals, two by default, and
+    //  the offsets computed between the rounded integers, so relative coordinates never
+    //  accumulate drift.  Segments with non-finite endpoints are skipped, those beyond the
+    //  range of 64 bit fixed point are written unrounded.
+    class LineBatch : public BatchShape {
+    public:
+        LineBatch(Stroke const &stroke = Stroke()) : BatchShape(Fill(), stroke) {}
 
-            return optional<Dimensions>(Dimensions(max->x - min->x, max->y - min->y));
+        std::uint32_t addStyle(Stroke const &style_stroke) {
+            return BatchShape::addStyle(Fill(), style_stroke);
         }
 
-        std::string axisString(Layout const &layout) const {
-            optional<Dimensions> dimensions = getDimensions();
-            if (!dimensions)
-                return "";
+        LineBatch &add(Point const &start_point, Point const &end_point, std::uint32_t style = 0) {
+            pushStyle(style, x1s.size());
+            x1s.push_back(start_point.x);
+            y1s.push_back(start_point.y);
+            x2s.push_back(end_point.x);
+            y2s.push_back(end_point.y);
+            return *this;
+        }
 
-            // Make the axis 10% wider and higher than the data points.
-            double width = dimensions->width * 1.1;
-            double height = dimensions->height * 1.1;
+        LineBatch &add(double const *x1, double const *y1, double const *x2, double const *y2,
+                       std::size_t count, std::uint32_t style = 0) {
+            for (std::size_t i = 0; i < count; ++i)
+                pushStyle(style, x1s.size() + i);
+            x1s.insert(x1s.end(), x1, x1 + count);
+            y1s.insert(y1s.end(), y1, y1 + count);
+            x2s.insert(x2s.end(), x2, x2 + count);
+            y2s.insert(y2s.end(), y2, y2 + count);
+            return *this;
+        }
 
-            // Draw the axis.
-            Polyline axis(Color::Transparent, axis_stroke);
-            axis << Point(margin.width, margin.height + height) << Point(margin.width, margin.height)
-                 << Point(margin.width + width, margin.height);
+        void reserve(std::size_t count) {
+            x1s.reserve(count);
+            y1s.reserve(count);
+            x2s.reserve(count);
+            y2s.reserve(count);
+        }
 
-            return axis.toString();
+        std::size_t size() const { return x1s.size(); }
+
+        // Decimals kept in the output, between 0 and 9.
+        LineBatch &setPrecision(int decimals) {
+            precision = std::max(0, std::min(decimals, 9));
+            return *this;
         }
 
-        std::string axisString() const {
-            optional<Dimensions> dimensions = getDimensions();
-            if (!dimensions)
-                return "";
+        std::string toString() const {
+            double scale = std::pow(10.0, precision);
+            std::int64_t previous_x = 0, previous_y = 0;
+            bool open = false;
 
-            // Make the axis 10% wider and higher than the data points.
-            double width = dimensions->width * 1.1;
-            double height = dimensions->height * 1.1;
+            std::string ret;
+            ret.reserve(x1s.size() * 20);
+            appendPaths(ret, x1s.size(), [&](std::string &out, std::size_t i, bool first) {
+                open = open && !first;
+                if (!finite(i))
+                    return;
+
+                // Coordinates too large for fixed point are written as they are, absolute.
+                double limit = 4611686018427387904.0 / scale;
+                if (!((std::fabs(x1s[i]) < limit) & (std::fabs(y1s[i]) < limit) & (std::fabs(x2s[i]) < limit)
+                      & (std::fabs(y2s[i]) < limit))) {
+                    out += 'M';
+                    appendNumber(out, x1s[i]);
+                    out += ',';
+                    appendNumber(out, y1s[i]);
+                    out += 'L';
+                    appendNumber(out, x2s[i]);
+                    out += ',';
+                    appendNumber(out, y2s[i]);
+                    open = false;
+                    return;
+                }
 
-            // Draw the axis.
-            Polyline axis(Color::Transparent, axis_stroke);
-            axis << Point(margin.width, margin.height + height) << Point(margin.width, margin.height)
-                 << Point(margin.width + width, margin.height);
+                std::int64_t x1 = std::llround(x1s[i] * scale), y1 = std::llround(y1s[i] * scale);
+                std::int64_t x2 = std::llround(x2s[i] * scale), y2 = std::llround(y2s[i] * scale);
+
+                char buffer[96];
+                char *cursor = buffer;
+                *cursor++ = open ? 'm' : 'M';
+                cursor = formatFixed(cursor, open ? x1 - previous_x : x1, precision);
+                *cursor++ = ',';
+                cursor = formatFixed(cursor, open ? y1 - previous_y : y1, precision);
+                *cursor++ = 'l';
+                cursor = formatFixed(cursor, x2 - x1, precision);
+                *cursor++ = ',';
+                cursor = formatFixed(cursor, y2 - y1, precision);
+                out.append(buffer, cursor - buffer);
+
+                previous_x = x2;
+                previous_y = y2;
+                open = true;
+            });
+            return ret;
+        }
 
-            return axis.toString();
+        void offset(Point const &offset) {
+            for (std::size_t i = 0; i < x1s.size(); ++i) {
+                x1s[i] += offset.x;
+                x2s[i] += offset.x;
+                y1s[i] += offset.y;
+                y2s[i] += offset.y;
+            }
         }
 
-        std::string polylineToString(Polyline const &polyline) const {
-            Polyline shifted_polyline = polyline;
-            shifted_polyline.offset(Point(margin.width, margin.height));
+        virtual Rect MinMax() const {
+            return batchBounds(x1s.size(), [this](int axis, std::size_t begin, std::size_t n, double *lower, double *upper) {
+                double const *starts = (axis == 0 ? x1s.data() : y1s.data()) + begin;
+                double const *ends = (axis == 0 ? x2s.data() : y2s.data()) + begin;
+                for (std::size_t i = 0; i < n; ++i) {
+                    lower[i] = std::min(starts[i], ends[i]);
+                    upper[i] = std::max(starts[i], ends[i]);
+                }
+            }, [this](std::size_t i) { return finite(i); });
+        }
 
-            std::vector<Circle> vertices;
-            for (unsigned i = 0; i < shifted_polyline.points.size(); ++i)
-                vertices.push_back(Circle(shifted_polyline.points[i], getDimensions()->height / 30.0, Color::Black));
+        void toScene(Scene &scene) const {
+            for (std::size_t i = 0; i < x1s.size(); ++i)
+                if (finite(i))
+                    scene.add(Scene::LineCommand, fillOf(styleOf(i)), strokeOf(styleOf(i)),
+                              {x1s[i], y1s[i], x2s[i], y2s[i]});
+        }
 
-            return shifted_polyline.toString() + vectorToString(vertices);
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret = batchMemoryUsage();
+            ret.objects = sizeof(*this);
+            ret.points = vectorMemory(x1s) + vectorMemory(y1s) + vectorMemory(x2s) + vectorMemory(y2s);
+            return ret;
         }
 
-        std::string polylineToString(Polyline const &polyline, Layout const &layout) const {
-            Polyline shifted_polyline = polyline;
-            shifted_polyline.offset(Point(margin.width, margin.height));
+    private:
+        std::vector<double> x1s, y1s, x2s, y2s;
+        int precision = 2;
 
-            std::vector<Circle> vertices;
-            for (unsigned i = 0; i < shifted_polyline.points.size(); ++i)
-                vertices.push_back(Circle(shifted_polyline.points[i], getDimensions()->height / 30.0, Color::Black));
+        bool finite(std::size_t i) const {
+            return (x1s[i] - x1s[i] == 0) & (y1s[i] - y1s[i] == 0) & (x2s[i] - x2s[i] == 0)
+                   & (y2s[i] - y2s[i] == 0);
+        }
+    };
+
+    class Text : public Shape {
+    public:
+        Text(Point const &origin, std::string const &content, Fill const &fill = Fill(),
+             Font const &font = Font(), Stroke const &stroke = Stroke())
+                : Shape(fill, stroke), origin(origin), content(content), font(font) {}
+
+        std::string toString() const {
+            return element(styleString());
+        }
+
+        std::string bareString() const {
+            return element("");
+        }
+
+        std::string styleString() const {
+            return Shape::styleString() + font.toString();
+        }
+
+        void offset(Point const &offset) {
+            origin.x += offset.x;
+            origin.y += offset.y;
+        }
+
+        virtual Rect MinMax() const {
+            Rect rtn(origin);
+            return rtn;
+        }
+
+        void toScene(Scene &scene) const {
+            scene.addText(origin, content, fill, font, stroke);
+        }
 
-            return shifted_polyline.toString() + vectorToString(vertices, layout);
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret;
+            ret.objects = sizeof(*this);
+            ret.strings = stringMemory(content) + font.memoryUsage();
+            return ret;
+        }
+
+    private:
+        std::string element(std::string const &style) const {
+            std::stringstream ss;
+            ss << elemStart("text") << attribute("x", origin.x)
+               << attribute("y", origin.y)
+               << style
+               << ">" << content << elemEnd("text");
+            return ss.str();
         }
+
+        Point origin;
+        std::string content;
+        Font font;
     };
 
-    class Document {
+    // Any number of labels sharing one fill and font, written as <text> elements inside a
+    //  single <g> that carries the presentation attributes.
+    class TextBatch : public Shape {
     public:
-        Document(std::string const &file_name, Layout layout = Layout())
-                : file_name(file_name), layout(layout) {}
+        enum Anchor {
+            Start, Middle, End
+        };
 
-        Rect region;
+        TextBatch(Fill const &fill = Fill(), Font const &font = Font(), Anchor anchor = Start)
+                : Shape(fill), font(font), anchor(anchor) {}
 
-        Document &operator<<(Shape const &shape) {
-            body_nodes_str += shape.toString();
-            region.include(shape.MinMax());
+        TextBatch &add(Point const &origin, std::string const &content) {
+            xs.push_back(origin.x);
+            ys.push_back(origin.y);
+            contents += content;
+            content_ends.push_back(contents.size());
             return *this;
         }
 
+        void reserve(std::size_t count, std::size_t characters = 0) {
+            xs.reserve(count);
+            ys.reserve(count);
+            content_ends.reserve(count);
+            contents.reserve(characters);
+        }
+
+        std::size_t size() const { return xs.size(); }
+
         std::string toString() const {
+            if (xs.empty())
+                return "";
 
-            std::stringstream ss;
-            ss << "<?xml " << attribute("version", "1.0") << attribute("standalone", "no")
-               << "?>\n<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" "
-               << "\"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n<svg "
-               << attribute("width", region.width(), "px")
-               << attribute("height", region.height(), "px")
-               << attribute("xmlns", "http://www.w3.org/2000/svg")
-               << attribute("viewBox",
-                            std::to_string(region.minPt.x) + " " +
-                            std::to_string(region.minPt.y) + " " +
-                            std::to_string(region.width()) + " " +
-                            std::to_string(region.height()))
-               << attribute("version", "1.1") << ">\n" << body_nodes_str << elemEnd("svg");
-            return ss.str();
+            static char const *const anchors[] = {"start", "middle", "end"};
+            std::string ret = elemStart("g") + styleString() + attribute("text-anchor", anchors[anchor]) + ">\n";
+            ret.reserve(ret.size() + xs.size() * 40 + contents.size());
+            for (std::size_t i = 0; i < xs.size(); ++i) {
+                ret += "\t\t<text x=\"";
+                appendNumber(ret, xs[i]);
+                ret += "\" y=\"";
+                appendNumber(ret, ys[i]);
+                ret += "\">";
+                ret.append(contents, contentBegin(i), content_ends[i] - contentBegin(i));
+                ret += "</text>\n";
+            }
+            return ret + elemEnd("g");
         }
 
-        bool save() const {
-            std::ofstream ofs(file_name.c_str());
-            if (!ofs.good())
-                return false;
+        std::string styleString() const {
+            return Shape::styleString() + font.toString();
+        }
 
-            ofs << toString();
-            ofs.close();
-            return true;
+        void offset(Point const &offset) {
+            for (auto &x : xs)
+                x += offset.x;
+            for (auto &y : ys)
+                y += offset.y;
         }
 
-    private:
-        std::string file_name;
-        Layout layout;
+        virtual Rect MinMax() const {
+            Rect ret;
+            double lower, upper;
+            if (minMax(xs.data(), xs.data(), xs.size(), lower, upper)) {
+                ret.minPt.x = lower;
+                ret.maxPt.x = upper;
+            }
+            if (minMax(ys.data(), ys.data(), ys.size(), lower, upper)) {
+                ret.minPt.y = lower;
+                ret.maxPt.y = upper;
+            }
+            return ret;
+        }
+
+        void toScene(Scene &scene) const {
+            for (std::size_t i = 0; i < xs.size(); ++i)
+                scene.addText(Point(xs[i], ys[i]), contents.substr(contentBegin(i), content_ends[i] - contentBegin(i)),
+                              fill, font, Stroke());
+        }
+
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret;
+            ret.objects = sizeof(*this);
+            ret.points = vectorMemory(xs) + vectorMemory(ys) + vectorMemory(content_ends);
+            ret.strings = stringMemory(contents) + font.memoryUsage();
+            return ret;
+        }
+
+    private:
+        Font font;
+        Anchor anchor;
+        std::vector<double> xs, ys;
+        std::string contents;
+        std::vector<std::size_t> content_ends;
+
+        std::size_t contentBegin(std::size_t i) const {
+            return i == 0 ? 0 : content_ends[i - 1];
+        }
+    };
+
+    // Group of shapes defined once and drawn by any number of Use shapes, e.g. markers.  The
+    //  id is a hash of the content, so equal symbols of different documents share an id.
+    class Symbol {
+    public:
+        Symbol() {}
+
+        Symbol &operator<<(Shape const &shape) {
+            content += shape.toString();
+            region.include(shape.MinMax());
+            shape.collectDefinitions(nested_definitions);
+            return *this;
+        }
+
+        std::shared_ptr<const Definition> makeDefinition() const {
+            std::stringstream id;
+            id << "symbol" << std::hex << hashString(content);
+
+            std::shared_ptr<Definition> ret = std::make_shared<Definition>();
+            ret->id = id.str();
+            ret->content = elemStart("symbol") + attribute("id", ret->id) + attribute("overflow", "visible")
+                           + ">\n" + content + "\t" + elemEnd("symbol");
+            ret->dependencies = nested_definitions.items();
+            return ret;
+        }
+
+        Rect region;
+
+    private:
+        std::string content;
+        Definitions nested_definitions;
+    };
+
+    class Use : public Shape {
+    public:
+        Use(Symbol const &symbol, Point const &position = Point(0, 0),
+            Fill const &fill = Fill(), Stroke const &stroke = Stroke())
+                : Shape(fill, stroke), symbol(symbol.makeDefinition()), symbol_region(symbol.region),
+                  position(position) {}
+
+        std::string toString() const {
+            std::stringstream ss;
+            ss << elemStart("use") << attribute("xlink:href", "#" + symbol->id)
+               << attribute("x", position.x) << attribute("y", position.y)
+               << fill.toString() << stroke.toString() << emptyElemEnd();
+            return ss.str();
+        }
+
+        void offset(Point const &offset) {
+            position.x += offset.x;
+            position.y += offset.y;
+        }
+
+        virtual Rect MinMax() const {
+            Rect rtn(Point(symbol_region.minPt.x + position.x, symbol_region.minPt.y + position.y),
+                     symbol_region.width(), symbol_region.height());
+            return rtn;
+        }
+
+        void collectDefinitions(Definitions &definitions) const {
+            Shape::collectDefinitions(definitions);
+            definitions.add(symbol);
+        }
+
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret;
+            ret.objects = sizeof(*this);
+            return ret;
+        }
+
+    private:
+        std::shared_ptr<const Definition> symbol;
+        Rect symbol_region;
+        Point position;
+    };
+
+    // Sample charting class.  Each series is drawn as an open path, so NaN or infinite samples
+    //  leave gaps instead of being bridged.
+    class LineChart : public Shape {
+    public:
+        LineChart(Dimensions margin = Dimensions(), double scale = 1,
+                  Stroke const &axis_stroke = Stroke(.5, Color::Purple))
+                : axis_stroke(axis_stroke), margin(margin), scale(scale) {}
+
+        LineChart &operator<<(Polyline const &polyline) {
+            if (polyline.points.empty())
+                return *this;
+
+            polylines.push_back(polyline);
+            if (!linearScales())
+                addScaled(polyline);
+            return *this;
+        }
+
+        // Axis scales for all polylines, whether added before or after.  The values as added
+        //  are kept, and a scaled copy is made once per polyline when a scale is not linear.
+        LineChart &setScales(Scale const &x, Scale const &y) {
+            x_scale = x;
+            y_scale = y;
+            scaled.clear();
+            if (!linearScales())
+                for (auto const &polyline : polylines)
+                    addScaled(polyline);
+            return *this;
+        }
+
+        std::string toString() const {
+            std::vector<Polyline> const &series = this->series();
+            if (series.empty())
+                return "";
+
+            std::string ret;
+            for (unsigned i = 0; i < series.size(); ++i)
+                ret += polylineToString(series[i]);
+
+            return ret + axisString();
+        }
+
+        void offset(Point const &offset) {
+            for (unsigned i = 0; i < polylines.size(); ++i)
+                polylines[i].offset(offset);
+            for (unsigned i = 0; i < scaled.size(); ++i)
+                scaled[i].offset(offset);
+        }
+
+        virtual Rect MinMax() const {
+            Rect rtn;
+            return rtn;
+        }
+
+        void collectDefinitions(Definitions &definitions) const {
+            for (unsigned i = 0; i < polylines.size(); ++i)
+                polylines[i].collectDefinitions(definitions);
+        }
+
+        void toScene(Scene &scene) const {
+            std::vector<Polyline> const &series = this->series();
+            if (series.empty())
+                return;
+
+            double radius = vertexRadius();
+            for (unsigned i = 0; i < series.size(); ++i) {
+                Polyline shifted_polyline = series[i];
+                shifted_polyline.offset(Point(margin.width, margin.height));
+                shifted_polyline.toPath().toScene(scene);
+
+                for (unsigned j = 0; j < shifted_polyline.points.size(); ++j)
+                    if (isFinite(shifted_polyline.points[j]))
+                        Circle(shifted_polyline.points[j], radius, Color::Black).toScene(scene);
+            }
+            axis().toScene(scene);
+        }
+
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret;
+            ret.objects = sizeof(*this);
+            ret.buffers = vectorMemory(polylines) - polylines.size() * sizeof(Polyline)
+                          + vectorMemory(scaled) - scaled.size() * sizeof(Polyline);
+            for (auto const &polyline : polylines)
+                ret += polyline.memoryUsage();
+            for (auto const &polyline : scaled)
+                ret += polyline.memoryUsage();
+            return ret;
+        }
+
+    private:
+        Stroke axis_stroke;
+        Dimensions margin;
+        double scale;
+        Scale x_scale, y_scale;
+        std::vector<Polyline> polylines, scaled;
+
+        bool linearScales() const {
+            return x_scale.type == Scale::Linear && y_scale.type == Scale::Linear;
+        }
+
+        void addScaled(Polyline const &polyline) {
+            scaled.push_back(polyline);
+            std::vector<Point> &points = scaled.back().points;
+            scalePoints(&points[0], points.size(), x_scale, y_scale);
+        }
+
+        // The polylines as drawn.
+        std::vector<Polyline> const &series() const {
+            return linearScales() ? polylines : scaled;
+        }
+
+        // Vertex markers scale with the data, charts without finite points have none to draw.
+        double vertexRadius() const {
+            optional<Dimensions> dimensions = getDimensions();
+            return !dimensions ? 0 : dimensions->height / 30.0;
+        }
+
+        optional<Dimensions> getDimensions() const {
+            std::vector<Polyline> const &series = this->series();
+            if (series.empty())
+                return optional<Dimensions>();
+
+            // One pass over the finite points of each polyline.
+            Rect region;
+            bool found = false;
+            for (unsigned i = 0; i < series.size(); ++i) {
+                Rect bounds;
+                if (!finiteBounds(series[i].points, bounds))
+                    continue;
+
+                if (found)
+                    region.include(bounds);
+                else
+                    region = bounds;
+                found = true;
+            }
+            if (!found)
+                return optional<Dimensions>();
+
+            return optional<Dimensions>(Dimensions(region.width(), region.height()));
+        }
+
+        std::string axisString(Layout const &layout) const {
+            optional<Dimensions> dimensions = getDimensions();
+            if (!dimensions)
+                return "";
+
+            // Make the axis 10% wider and higher than the data points.
+            double width = dimensions->width * 1.1;
+            double height = dimensions->height * 1.1;
+
+            // Draw the axis.
+            Polyline axis(Color::Transparent, axis_stroke);
+            axis << Point(margin.width, margin.height + height) << Point(margin.width, margin.height)
+                 << Point(margin.width + width, margin.height);
+
+            return axis.toString();
+        }
+
+        std::string axisString() const {
+            optional<Dimensions> dimensions = getDimensions();
+            if (!dimensions)
+                return "";
+
+            return axis().toString();
+        }
+
+        Polyline axis() const {
+            Polyline axis(Color::Transparent, axis_stroke);
+            optional<Dimensions> dimensions = getDimensions();
+            if (!dimensions)
+                return axis;
+
+            // Make the axis 10% wider and higher than the data points.
+            double width = dimensions->width * 1.1;
+            double height = dimensions->height * 1.1;
+
+            // Draw the axis.
+            axis << Point(margin.width, margin.height + height) << Point(margin.width, margin.height)
+                 << Point(margin.width + width, margin.height);
+            return axis;
+        }
+
+        std::string polylineToString(Polyline const &polyline) const {
+            Polyline shifted_polyline = polyline;
+            shifted_polyline.offset(Point(margin.width, margin.height));
+
+            double radius = vertexRadius();
+            std::vector<Circle> vertices;
+            for (unsigned i = 0; i < shifted_polyline.points.size(); ++i)
+                if (isFinite(shifted_polyline.points[i]))
+                    vertices.push_back(Circle(shifted_polyline.points[i], radius, Color::Black));
+
+            return shifted_polyline.toPath().toString() + vectorToString(vertices);
+        }
+
+        std::string polylineToString(Polyline const &polyline, Layout const &layout) const {
+            Polyline shifted_polyline = polyline;
+            shifted_polyline.offset(Point(margin.width, margin.height));
+
+            double radius = vertexRadius();
+            std::vector<Circle> vertices;
+            for (unsigned i = 0; i < shifted_polyline.points.size(); ++i)
+                if (isFinite(shifted_polyline.points[i]))
+                    vertices.push_back(Circle(shifted_polyline.points[i], radius, Color::Black));
+
+            return shifted_polyline.toPath().toString() + vectorToString(vertices, layout);
+        }
+    };
+
+    // Days since 1970-01-01 and proleptic Gregorian dates, after Howard Hinnant's algorithms.
+    static inline std::int64_t daysFromCivil(std::int64_t year, unsigned month, unsigned day) {
+        year -= month <= 2;
+        std::int64_t era = (year >= 0 ? year : year - 399) / 400;
+        std::int64_t year_of_era = year - era * 400;
+        std::int64_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+        std::int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+        return era * 146097 + day_of_era - 719468;
+    }
+
+    static inline void civilFromDays(std::int64_t days, std::int64_t &year, unsigned &month, unsigned &day) {
+        days += 719468;
+        std::int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+        std::int64_t day_of_era = days - era * 146097;
+        std::int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+        std::int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+        std::int64_t shifted_month = (5 * day_of_year + 2) / 153;
+        day = unsigned(day_of_year - (153 * shifted_month + 2) / 5 + 1);
+        month = unsigned(shifted_month < 10 ? shifted_month + 3 : shifted_month - 9);
+        year = year_of_era + era * 400 + (month <= 2);
+    }
+
+    static inline std::int64_t floorDiv(std::int64_t value, std::int64_t divisor) {
+        std::int64_t quotient = value / divisor;
+        return quotient - (value % divisor < 0);
+    }
+
+    static inline std::int64_t floorMod(std::int64_t value, std::int64_t divisor) {
+        std::int64_t remainder = value % divisor;
+        return remainder < 0 ? remainder + divisor : remainder;
+    }
+
+    // to - from for from <= to, exact over the whole int64 range.
+    static inline std::uint64_t distance(std::int64_t from, std::int64_t to) {
+        return std::uint64_t(to) - std::uint64_t(from);
+    }
+
+    // Horizontal axis for UTC timestamps in nanoseconds since the epoch, mapping [start, end]
+    //  onto `length` units right of `origin`.  Tick intervals follow the calendar: seconds and
+    //  minutes in 1-2-5-10-15-30 steps, hours dividing a day, Monday aligned weeks, months,
+    //  quarters and years.  Labels come from an allocation free formatter that reuses the
+    //  "YYYY-MM-DD" prefix while consecutive labels fall on the same day.  Any range within
+    //  int64 is handled without overflow.
+    class TimeAxis : public Shape {
+    public:
+        enum Precision {
+            Years, Months, Days, Minutes, Seconds, Milliseconds, Nanoseconds
+        };
+
+        TimeAxis(Point const &origin, double length, std::int64_t start, std::int64_t end,
+                 Font const &font = Font(), Stroke const &stroke = Stroke(.5, Color::Purple),
+                 Fill const &label_fill = Fill(Color::Black), unsigned max_ticks = 10)
+                : Shape(label_fill, stroke), origin(origin), length(length), font(font),
+                  max_ticks(std::max(1u, max_ticks)) {
+            setRange(start, end);
+        }
+
+        // Move the window, for instance to follow incoming data.
+        TimeAxis &setRange(std::int64_t range_start, std::int64_t range_end) {
+            start = range_start;
+            end = std::max(range_start, range_end);
+            chooseStep();
+            return *this;
+        }
+
+        Precision precision() const { return label_precision; }
+
+        std::vector<std::int64_t> ticks() const {
+            std::vector<std::int64_t> ret;
+            if (step_months == 0) {
+                // Weeks start on Monday, 1970-01-01 was a Thursday.  Steps are taken while
+                //  they fit before `end`, so ticks near the int64 limits cannot overflow.
+                std::int64_t anchor = step_nanos == 7 * day_nanos ? 4 * day_nanos : 0;
+                std::int64_t ahead = floorMod(anchor, step_nanos) - floorMod(start, step_nanos);
+                if (ahead < 0)
+                    ahead += step_nanos;
+                if (std::uint64_t(ahead) > distance(start, end))
+                    return ret;
+                for (std::int64_t tick = start + ahead;; tick += step_nanos) {
+                    ret.push_back(tick);
+                    if (distance(tick, end) < std::uint64_t(step_nanos))
+                        break;
+                }
+                return ret;
+            }
+
+            // Months are compared in days, their first nanosecond may not be representable.
+            std::int64_t start_day = floorDiv(start, day_nanos), end_day = floorDiv(end, day_nanos);
+            std::int64_t year;
+            unsigned month, day;
+            civilFromDays(start_day, year, month, day);
+            std::int64_t index = year * 12 + month - 1;
+            if (day != 1 || floorMod(start, day_nanos) != 0)
+                ++index;
+            index = -floorDiv(-index, step_months) * step_months;
+            for (;; index += step_months) {
+                std::int64_t tick_year = floorDiv(index, 12);
+                std::int64_t tick_day = daysFromCivil(tick_year, unsigned(index - tick_year * 12 + 1), 1);
+                if (tick_day > end_day)
+                    break;
+                ret.push_back(tick_day * day_nanos);
+            }
+            return ret;
+        }
+
+        // Writes the label of `time` at the current precision into `out`, which must hold 32
+        //  characters, and returns its length.
+        std::size_t format(std::int64_t time, char *out) const {
+            DayPrefix prefix;
+            return format(time, out, prefix);
+        }
+
+        std::string toString() const {
+            std::vector<std::int64_t> times = ticks();
+            return axis(times).toString() + labelsString(times);
+        }
+
+        void offset(Point const &offset) {
+            origin.x += offset.x;
+            origin.y += offset.y;
+        }
+
+        virtual Rect MinMax() const {
+            Rect rtn(origin, length, tickLength() + font.fontSize());
+            return rtn;
+        }
+
+        void toScene(Scene &scene) const {
+            std::vector<std::int64_t> times = ticks();
+            axis(times).toScene(scene);
+
+            char label[32];
+            DayPrefix prefix;
+            for (auto time : times)
+                scene.addText(Point(position(time), labelY()), std::string(label, format(time, label, prefix)),
+                              fill, font, Stroke());
+        }
+
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret;
+            ret.objects = sizeof(*this);
+            ret.strings = font.memoryUsage();
+            return ret;
+        }
+
+    private:
+        struct DayPrefix {
+            DayPrefix() : day(std::numeric_limits<std::int64_t>::min()) {}
+
+            std::int64_t day;
+            char text[10];
+        };
+
+        static const std::int64_t day_nanos = 86400000000000LL;
+
+        Point origin;
+        double length;
+        std::int64_t start = 0, end = 0;
+        Font font;
+        unsigned max_ticks;
+
+        std::int64_t step_nanos = 1;
+        std::int64_t step_months = 0;
+        Precision label_precision = Nanoseconds;
+
+        // Formats with `prefix` holding the date part of the previous label, if any.
+        std::size_t format(std::int64_t time, char *out, DayPrefix &prefix) const {
+            std::int64_t days = floorDiv(time, day_nanos);
+            std::int64_t nanos = floorMod(time, day_nanos);
+
+            if (prefix.day != days) {
+                std::int64_t year;
+                unsigned month, day;
+                civilFromDays(days, year, month, day);
+                char *cursor = prefix.text;
+                cursor = writeDigits(cursor, unsigned(year / 100));
+                cursor = writeDigits(cursor, unsigned(year % 100));
+                *cursor++ = '-';
+                cursor = writeDigits(cursor, month);
+                *cursor++ = '-';
+                writeDigits(cursor, day);
+                prefix.day = days;
+            }
+
+            static const std::size_t prefix_sizes[] = {4, 7, 10, 10, 10, 10, 10};
+            std::memcpy(out, prefix.text, 10);
+            char *cursor = out + prefix_sizes[label_precision];
+            if (label_precision < Minutes)
+                return cursor - out;
+
+            std::int64_t seconds = nanos / 1000000000;
+            *cursor++ = ' ';
+            cursor = writeDigits(cursor, unsigned(seconds / 3600));
+            *cursor++ = ':';
+            cursor = writeDigits(cursor, unsigned(seconds / 60 % 60));
+            if (label_precision >= Seconds) {
+                *cursor++ = ':';
+                cursor = writeDigits(cursor, unsigned(seconds % 60));
+            }
+            if (label_precision >= Milliseconds) {
+                std::int64_t fraction = nanos % 1000000000;
+                int digits = label_precision == Milliseconds ? 3 : 9;
+                if (digits == 3)
+                    fraction /= 1000000;
+                *cursor++ = '.';
+                for (int i = digits - 1; i >= 0; --i) {
+                    cursor[i] = char('0' + fraction % 10);
+                    fraction /= 10;
+                }
+                cursor += digits;
+            }
+            return cursor - out;
+        }
+
+        static char *writeDigits(char *out, unsigned value) {
+            std::memcpy(out, digitPairs() + value * 2, 2);
+            return out + 2;
+        }
+
+        // Smallest calendar step giving at most max_ticks ticks.
+        void chooseStep() {
+            struct Step {
+                std::int64_t nanos;
+                std::int64_t months;
+                Precision precision;
+            };
+            static const std::int64_t second = 1000000000, minute = 60 * second, hour = 60 * minute;
+            static const Step calendar_steps[] = {
+                    {second, 0, Seconds}, {2 * second, 0, Seconds}, {5 * second, 0, Seconds},
+                    {10 * second, 0, Seconds}, {15 * second, 0, Seconds}, {30 * second, 0, Seconds},
+                    {minute, 0, Minutes}, {2 * minute, 0, Minutes}, {5 * minute, 0, Minutes},
+                    {10 * minute, 0, Minutes}, {15 * minute, 0, Minutes}, {30 * minute, 0, Minutes},
+                    {hour, 0, Minutes}, {2 * hour, 0, Minutes}, {3 * hour, 0, Minutes},
+                    {6 * hour, 0, Minutes}, {12 * hour, 0, Minutes},
+                    {day_nanos, 0, Days}, {2 * day_nanos, 0, Days}, {7 * day_nanos, 0, Days},
+                    {0, 1, Months}, {0, 3, Months}, {0, 6, Months},
+                    {0, 12, Years}, {0, 24, Years}, {0, 60, Years}, {0, 120, Years},
+                    {0, 240, Years}, {0, 600, Years}, {0, 1200, Years}
+            };
+
+            double span = double(distance(start, end));
+            step_months = 0;
+            for (std::int64_t decade = 1; decade < second; decade *= 10)
+                for (std::int64_t factor : {1, 2, 5}) {
+                    step_nanos = decade * factor;
+                    label_precision = step_nanos < 1000000 ? Nanoseconds : Milliseconds;
+                    if (span / double(step_nanos) <= max_ticks)
+                        return;
+                }
+
+            for (auto const &step : calendar_steps) {
+                step_nanos = step.nanos;
+                step_months = step.months;
+                label_precision = step.precision;
+                double nanos = step.months ? step.months * (day_nanos * 30.436875) : double(step.nanos);
+                if (span / nanos <= max_ticks)
+                    return;
+            }
+        }
+
+        double tickLength() const { return font.fontSize() / 2; }
+
+        double labelY() const { return origin.y + tickLength() + font.fontSize(); }
+
+        double position(std::int64_t time) const {
+            return end > start ? origin.x + double(distance(start, time)) * (length / double(distance(start, end)))
+                               : origin.x;
+        }
+
+        Path axis(std::vector<std::int64_t> const &times) const {
+            Path path(Fill(), stroke);
+            path.setClosed(false);
+            path << origin << Point(origin.x + length, origin.y);
+            for (auto time : times) {
+                double x = position(time);
+                path.startNewSubPath();
+                path << Point(x, origin.y) << Point(x, origin.y + tickLength());
+            }
+            return path;
+        }
+
+        std::string labelsString(std::vector<std::int64_t> const &times) const {
+            double y = labelY();
+
+            std::string ret = elemStart("g") + fill.toString() + font.toString() + attribute("text-anchor", "middle") + ">\n";
+            ret.reserve(ret.size() + times.size() * 64);
+            char label[32];
+            DayPrefix prefix;
+            for (auto time : times) {
+                ret += "\t\t<text x=\"";
+                appendNumber(ret, position(time));
+                ret += "\" y=\"";
+                appendNumber(ret, y);
+                ret += "\">";
+                ret.append(label, format(time, label, prefix));
+                ret += "</text>\n";
+            }
+            return ret + elemEnd("g");
+        }
+    };
+
+    // Candlestick chart drawn straight from raw trades.  Ticks in [start, end) are aggregated
+    //  into one candle per `candle_pixels` wide column of `area` at the Layout scale, so the
+    //  output size depends on the width only.  Rising candles (close >= open) and falling
+    //  ones are written as two paths, each candle a wick subpath and a body subpath.
+    class CandlestickChart : public Shape {
+    public:
+        struct Candle {
+            std::int64_t open_time, close_time;
+            double open, high, low, close, volume;
+        };
+
+        CandlestickChart(Rect const &area, std::int64_t start, std::int64_t end, Layout const &layout = Layout(),
+                         Color const &up = Color::Green, Color const &down = Color::Red, double candle_pixels = 1)
+                : area(area), start(start), end(end), up(up), down(down) {
+            double columns = std::floor(translateScale(area.width(), layout) / std::max(candle_pixels, 1e-9));
+            candles.assign(std::size_t(std::max(1.0, std::min(columns, 1e7))), emptyCandle());
+        }
+
+        // Ticks with non-finite prices are skipped.  Chunks of the input are reduced on up to
+        //  `threads` threads into private candles which are merged in input order, so the
+        //  result matches a sequential pass.
+        CandlestickChart &add(std::int64_t const *times, double const *prices, double const *volumes,
+                              std::size_t count, unsigned threads = 0) {
+            if (threads == 0)
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            std::size_t blocks = std::max<std::size_t>(1, std::min<std::size_t>(threads, count / 65536));
+            std::vector<std::vector<Candle> > partials(blocks - 1, std::vector<Candle>(candles.size(), emptyCandle()));
+            parallelFor(blocks, [&](std::size_t first, std::size_t last) {
+                for (std::size_t block = first; block < last; ++block) {
+                    std::vector<Candle> &target = block == 0 ? candles : partials[block - 1];
+                    std::size_t begin = count * block / blocks, stop = count * (block + 1) / blocks;
+                    aggregate(target, times + begin, prices + begin, volumes ? volumes + begin : nullptr, stop - begin);
+                }
+            }, unsigned(blocks));
+
+            for (auto const &partial : partials)
+                for (std::size_t i = 0; i < candles.size(); ++i)
+                    merge(candles[i], partial[i]);
+            return *this;
+        }
+
+        CandlestickChart &add(std::vector<std::int64_t> const &times, std::vector<double> const &prices,
+                              std::vector<double> const &volumes, unsigned threads = 0) {
+            std::size_t count = std::min(times.size(), prices.size());
+            return add(times.data(), prices.data(), volumes.size() >= count ? volumes.data() : nullptr, count, threads);
+        }
+
+        // One candle per column, empty ones have open_time == INT64_MAX.
+        std::vector<Candle> const &getCandles() const { return candles; }
+
+        std::string toString() const {
+            double low, high;
+            if (!priceRange(low, high))
+                return "";
+
+            std::string ret;
+            ret.reserve(candles.size() * 64 + 256);
+            for (int rising = 1; rising >= 0; --rising) {
+                Color const &color = rising ? up : down;
+                std::size_t mark = ret.size();
+                ret += elemStart("path");
+                ret += "d=\"";
+                std::size_t path_begin = ret.size();
+                for (std::size_t i = 0; i < candles.size(); ++i) {
+                    Candle const &candle = candles[i];
+                    if (candle.open_time == std::numeric_limits<std::int64_t>::max()
+                        || (candle.close >= candle.open) != bool(rising))
+                        continue;
+
+                    double left = area.minPt.x + columnWidth() * (i + 0.1);
+                    ret += 'M';
+                    appendNumber(ret, left + columnWidth() * 0.4);
+                    ret += ',';
+                    appendNumber(ret, priceY(candle.high, low, high));
+                    ret += 'V';
+                    appendNumber(ret, priceY(candle.low, low, high));
+                    ret += 'M';
+                    appendNumber(ret, left);
+                    ret += ',';
+                    appendNumber(ret, priceY(std::max(candle.open, candle.close), low, high));
+                    ret += 'h';
+                    appendNumber(ret, columnWidth() * 0.8);
+                    ret += 'V';
+                    appendNumber(ret, priceY(std::min(candle.open, candle.close), low, high));
+                    ret += 'h';
+                    appendNumber(ret, -columnWidth() * 0.8);
+                    ret += 'z';
+                }
+                if (ret.size() == path_begin) {
+                    ret.resize(mark);
+                    continue;
+                }
+                ret += "\" ";
+                ret += Fill(color).toString();
+                ret += Stroke(columnWidth() * 0.2, color).toString();
+                ret += emptyElemEnd();
+            }
+            return ret;
+        }
+
+        void offset(Point const &offset) {
+            area.minPt.x += offset.x;
+            area.minPt.y += offset.y;
+            area.maxPt.x += offset.x;
+            area.maxPt.y += offset.y;
+        }
+
+        virtual Rect MinMax() const {
+            return area;
+        }
+
+        void toScene(Scene &scene) const {
+            double low, high;
+            if (!priceRange(low, high))
+                return;
+
+            for (std::size_t i = 0; i < candles.size(); ++i) {
+                Candle const &candle = candles[i];
+                if (candle.open_time == std::numeric_limits<std::int64_t>::max())
+                    continue;
+
+                Color const &color = candle.close >= candle.open ? up : down;
+                double left = area.minPt.x + columnWidth() * (i + 0.1);
+                double top = priceY(std::max(candle.open, candle.close), low, high);
+                scene.add(Scene::LineCommand, Fill(), Stroke(columnWidth() * 0.2, color),
+                          {left + columnWidth() * 0.4, priceY(candle.high, low, high),
+                           left + columnWidth() * 0.4, priceY(candle.low, low, high)});
+                scene.add(Scene::RectangleCommand, Fill(color), Stroke(columnWidth() * 0.2, color),
+                          {left, top, columnWidth() * 0.8, priceY(std::min(candle.open, candle.close), low, high) - top});
+            }
+        }
+
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret;
+            ret.objects = sizeof(*this);
+            ret.buffers = vectorMemory(candles);
+            return ret;
+        }
+
+    private:
+        Rect area;
+        std::int64_t start, end;
+        Color up, down;
+        std::vector<Candle> candles;
+
+        static Candle emptyCandle() {
+            Candle ret = {std::numeric_limits<std::int64_t>::max(), std::numeric_limits<std::int64_t>::min(),
+                          0, -HUGE_VAL, HUGE_VAL, 0, 0};
+            return ret;
+        }
+
+        double columnWidth() const { return area.width() / candles.size(); }
+
+        void aggregate(std::vector<Candle> &target, std::int64_t const *times, double const *prices,
+                       double const *volumes, std::size_t count) const {
+            double columns_per_time = double(target.size()) / double(distance(start, end));
+            for (std::size_t i = 0; i < count; ++i) {
+                std::int64_t time = times[i];
+                double price = prices[i];
+                if (time < start || time >= end || !(price - price == 0))
+                    continue;
+
+                std::size_t column = std::min(target.size() - 1,
+                                              std::size_t(double(distance(start, time)) * columns_per_time));
+                Candle &candle = target[column];
+                if (time < candle.open_time) {
+                    candle.open_time = time;
+                    candle.open = price;
+                }
+                if (time >= candle.close_time) {
+                    candle.close_time = time;
+                    candle.close = price;
+                }
+                candle.high = std::max(candle.high, price);
+                candle.low = std::min(candle.low, price);
+                if (volumes && volumes[i] - volumes[i] == 0)
+                    candle.volume += volumes[i];
+            }
+        }
+
+        // Combines with the candle of later input, ties in time keep the input order.
+        static void merge(Candle &candle, Candle const &later) {
+            if (later.open_time < candle.open_time) {
+                candle.open_time = later.open_time;
+                candle.open = later.open;
+            }
+            if (later.close_time >= candle.close_time) {
+                candle.close_time = later.close_time;
+                candle.close = later.close;
+            }
+            candle.high = std::max(candle.high, later.high);
+            candle.low = std::min(candle.low, later.low);
+            candle.volume += later.volume;
+        }
+
+        bool priceRange(double &low, double &high) const {
+            low = HUGE_VAL;
+            high = -HUGE_VAL;
+            for (auto const &candle : candles) {
+                low = std::min(low, candle.low);
+                high = std::max(high, candle.high);
+            }
+            return low <= high;
+        }
+
+        // Higher prices are drawn towards the top of the area.
+        double priceY(double price, double low, double high) const {
+            if (high == low)
+                return area.minPt.y + area.height() / 2;
+            return area.maxPt.y - (price - low) / (high - low) * area.height();
+        }
+    };
+
+    // KLL quantile sketch (Karnin, Lang and Liberty).  Values enter level 0, and once the
+    //  sketch holds as many values as all levels together may, the lowest level over its
+    //  capacity is sorted and every other value, from a random offset, moves up a level with
+    //  twice the weight.  Capacities shrink by 2/3 per level below the top, so memory stays
+    //  around 3k values for any stream, and sketches of the same k merge.  Rank error is
+    //  about 1.4 / k typically and rarely above 2.5 / k.  Non-finite values are skipped.
+    class QuantileSketch {
+    public:
+        explicit QuantileSketch(unsigned k = 200, std::uint64_t seed = 1)
+                : k(std::max(k, 8u)), state(seed * 0x9E3779B97F4A7C15ull + 1), levels(1), capacities(1, this->k) {}
+
+        void add(double value) {
+            if (!(value - value == 0))
+                return;
+
+            levels[0].push_back(value);
+            ++total;
+            minimum = std::min(minimum, value);
+            maximum = std::max(maximum, value);
+            if (++retained >= total_capacity)
+                compress();
+        }
+
+        void add(double const *values, std::size_t count) {
+            for (std::size_t i = 0; i < count; ++i)
+                add(values[i]);
+        }
+
+        void merge(QuantileSketch const &other) {
+            while (levels.size() < other.levels.size())
+                addLevel();
+            for (std::size_t level = 0; level < other.levels.size(); ++level)
+                levels[level].insert(levels[level].end(), other.levels[level].begin(), other.levels[level].end());
+            total += other.total;
+            retained += other.retained;
+            minimum = std::min(minimum, other.minimum);
+            maximum = std::max(maximum, other.maximum);
+            while (retained >= total_capacity)
+                compress();
+        }
+
+        std::uint64_t count() const { return total; }
+
+        double min() const { return minimum; }
+
+        double max() const { return maximum; }
+
+        // Value at rank q * count(), NaN for an empty sketch.
+        double quantile(double q) const {
+            double ret;
+            quantiles(&q, 1, &ret);
+            return ret;
+        }
+
+        // Several quantiles from one sort of the retained values.
+        void quantiles(double const *qs, std::size_t count, double *out) const {
+            quantiles(weightedItems(), qs, count, out);
+        }
+
+        // As above from the result of weightedItems(), for callers that also need the items.
+        void quantiles(std::vector<std::pair<double, std::uint64_t> > const &items, double const *qs,
+                       std::size_t count, double *out) const {
+            std::uint64_t weight = 0;
+            for (auto const &item : items)
+                weight += item.second;
+            for (std::size_t i = 0; i < count; ++i) {
+                if (items.empty() || !(qs[i] == qs[i])) {
+                    out[i] = std::numeric_limits<double>::quiet_NaN();
+                    continue;
+                }
+                if (qs[i] <= 0 || qs[i] >= 1) {
+                    out[i] = qs[i] <= 0 ? minimum : maximum;
+                    continue;
+                }
+
+                double rank = qs[i] * weight;
+                std::uint64_t cumulative = 0;
+                std::size_t n = 0;
+                while (n + 1 < items.size() && (cumulative += items[n].second) < rank)
+                    ++n;
+                out[i] = items[n].first;
+            }
+        }
+
+        // Retained values sorted ascending, with their weights.
+        std::vector<std::pair<double, std::uint64_t> > weightedItems() const {
+            std::vector<std::pair<double, std::uint64_t> > ret;
+            for (std::size_t level = 0; level < levels.size(); ++level)
+                for (double value : levels[level])
+                    ret.push_back(std::make_pair(value, std::uint64_t(1) << level));
+            std::sort(ret.begin(), ret.end());
+            return ret;
+        }
+
+        std::size_t memoryUsage() const {
+            std::size_t ret = vectorMemory(levels);
+            for (auto const &level : levels)
+                ret += vectorMemory(level);
+            return ret;
+        }
+
+    private:
+        unsigned k;
+        std::uint64_t state;
+        std::vector<std::vector<double> > levels;
+        std::uint64_t total = 0;
+        double minimum = HUGE_VAL, maximum = -HUGE_VAL;
+        std::vector<std::size_t> capacities;
+        std::size_t retained = 0, total_capacity = k;
+
+        void addLevel() {
+            levels.emplace_back();
+            capacities.resize(levels.size());
+            total_capacity = 0;
+            for (std::size_t level = 0; level < levels.size(); ++level) {
+                double depth = double(levels.size() - 1 - level);
+                capacities[level] = std::max<std::size_t>(2, std::size_t(std::ceil(k * std::pow(2.0 / 3.0, depth))));
+                total_capacity += capacities[level];
+            }
+        }
+
+        void compress() {
+            std::size_t level = 0;
+            while (level + 1 < levels.size() && levels[level].size() < capacities[level])
+                ++level;
+            if (level + 1 == levels.size())
+                addLevel();
+
+            // An odd value out stays behind, the rest halve into the next level.
+            std::vector<double> &values = levels[level];
+            std::sort(values.begin(), values.end());
+            std::size_t even = values.size() & ~std::size_t(1);
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            for (std::size_t i = (state >> 32) & 1; i < even; i += 2)
+                levels[level + 1].push_back(values[i]);
+            values.erase(values.begin(), values.begin() + even);
+            retained -= even / 2;
+        }
+    };
+
+    // Distribution charts of any number of groups, each summarized by a QuantileSketch so
+    //  memory per group is bounded.  Groups are placed left to right across `area` with
+    //  values increasing upwards on a scale shared by all groups.
+    class DistributionPlot : public Shape {
+    public:
+        std::size_t addGroup() {
+            groups.push_back(QuantileSketch(k, groups.size() + 1));
+            return groups.size() - 1;
+        }
+
+        QuantileSketch &group(std::size_t index) { return groups.at(index); }
+
+        QuantileSketch const &group(std::size_t index) const { return groups.at(index); }
+
+        // Values are sketched in fixed chunks, each with its own seed, on up to `threads`
+        //  threads and merged in order, so the result does not depend on the thread count.
+        //  Chunks are processed in waves to bound the memory of the partial sketches.
+        DistributionPlot &add(std::size_t index, double const *values, std::size_t count, unsigned threads = 0) {
+            QuantileSketch &target = groups.at(index);
+            std::size_t const chunk = 65536, wave = 64;
+            std::size_t chunks = (count + chunk - 1) / chunk;
+            for (std::size_t first = 0; first < chunks; first += wave) {
+                std::size_t size = std::min(wave, chunks - first);
+                std::vector<QuantileSketch> partials;
+                for (std::size_t n = 0; n < size; ++n)
+                    partials.push_back(QuantileSketch(k, (index + 1) * 1000003 + chunks_added + first + n));
+                parallelFor(size, [&](std::size_t begin, std::size_t end) {
+                    for (std::size_t n = begin; n < end; ++n) {
+                        std::size_t offset = (first + n) * chunk;
+                        partials[n].add(values + offset, std::min(chunk, count - offset));
+                    }
+                }, threads);
+
+                for (auto const &partial : partials)
+                    target.merge(partial);
+            }
+            chunks_added += chunks;
+            return *this;
+        }
+
+        DistributionPlot &add(std::size_t index, std::vector<double> const &values, unsigned threads = 0) {
+            return add(index, values.data(), values.size(), threads);
+        }
+
+        void offset(Point const &offset) {
+            area.minPt.x += offset.x;
+            area.minPt.y += offset.y;
+            area.maxPt.x += offset.x;
+            area.maxPt.y += offset.y;
+        }
+
+        virtual Rect MinMax() const {
+            return area;
+        }
+
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret;
+            ret.objects = sizeof(*this);
+            ret.buffers = vectorMemory(groups);
+            for (auto const &group : groups)
+                ret.buffers += group.memoryUsage();
+            return ret;
+        }
+
+    protected:
+        DistributionPlot(Rect const &area, Fill const &fill, Stroke const &stroke, unsigned k)
+                : Shape(fill, stroke), area(area), k(k) {}
+
+        Rect area;
+        unsigned k;
+        std::vector<QuantileSketch> groups;
+        std::uint64_t chunks_added = 0;
+
+        bool valueRange(double &low, double &high) const {
+            low = HUGE_VAL;
+            high = -HUGE_VAL;
+            for (auto const &group : groups) {
+                low = std::min(low, group.min());
+                high = std::max(high, group.max());
+            }
+            return low <= high;
+        }
+
+        double valueY(double value, double low, double high) const {
+            if (high == low)
+                return area.minPt.y + area.height() / 2;
+            return area.maxPt.y - (value - low) / (high - low) * area.height();
+        }
+
+        double groupWidth() const { return area.width() / groups.size(); }
+
+        double groupCenter(std::size_t index) const { return area.minPt.x + groupWidth() * (index + 0.5); }
+
+        // Closes the path element started by the caller, or drops it when `d` stayed empty.
+        static void endPath(std::string &out, std::size_t mark, std::size_t d_begin, std::string const &style) {
+            if (out.size() == d_begin) {
+                out.resize(mark);
+                return;
+            }
+            out += "\" ";
+            out += style;
+            out += emptyElemEnd();
+        }
+    };
+
+    // Box plots with quartile boxes, medians, and whiskers at the most extreme values within
+    //  1.5 interquartile ranges of the box.  Boxes form one filled path and medians and
+    //  whiskers one stroked path.
+    class BoxPlot : public DistributionPlot {
+    public:
+        BoxPlot(Rect const &area, Fill const &fill = Fill(Color::Silver), Stroke const &stroke = Stroke(1, Color::Black),
+                unsigned k = 200)
+                : DistributionPlot(area, fill, stroke, k) {}
+
+        struct Summary {
+            double low_whisker, q1, median, q3, high_whisker;
+        };
+
+        Summary summary(std::size_t index) const {
+            QuantileSketch const &sketch = group(index);
+            std::vector<std::pair<double, std::uint64_t> > items = sketch.weightedItems();
+            double const qs[] = {0.25, 0.5, 0.75};
+            double values[3];
+            sketch.quantiles(items, qs, 3, values);
+
+            // Whiskers end at the most extreme values within the fences, the exact extremes
+            //  when inside and otherwise the most extreme retained values.
+            double fence = 1.5 * (values[2] - values[0]);
+            double low_fence = values[0] - fence, high_fence = values[2] + fence;
+            Summary ret = {values[0], values[0], values[1], values[2], values[2]};
+            if (sketch.min() >= low_fence)
+                ret.low_whisker = sketch.min();
+            if (sketch.max() <= high_fence)
+                ret.high_whisker = sketch.max();
+            for (auto const &item : items) {
+                if (item.first >= low_fence)
+                    ret.low_whisker = std::min(ret.low_whisker, item.first);
+                if (item.first <= high_fence)
+                    ret.high_whisker = std::max(ret.high_whisker, item.first);
+            }
+            return ret;
+        }
+
+        std::string toString() const {
+            double low, high;
+            if (!valueRange(low, high))
+                return "";
+
+            std::vector<Summary> summaries;
+            for (std::size_t i = 0; i < groups.size(); ++i)
+                summaries.push_back(summary(i));
+            double width = groupWidth() * 0.6;
+
+            std::string ret;
+            std::size_t mark = ret.size();
+            ret += elemStart("path") + "d=\"";
+            std::size_t d_begin = ret.size();
+            for (std::size_t i = 0; i < groups.size(); ++i) {
+                if (groups[i].count() == 0)
+                    continue;
+                ret += 'M';
+                appendNumber(ret, groupCenter(i) - width / 2);
+                ret += ',';
+                appendNumber(ret, valueY(summaries[i].q3, low, high));
+                ret += 'h';
+                appendNumber(ret, width);
+                ret += 'V';
+                appendNumber(ret, valueY(summaries[i].q1, low, high));
+                ret += 'h';
+                appendNumber(ret, -width);
+                ret += 'z';
+            }
+            endPath(ret, mark, d_begin, styleString());
+
+            mark = ret.size();
+            ret += elemStart("path") + "d=\"";
+            d_begin = ret.size();
+            for (std::size_t i = 0; i < groups.size(); ++i) {
+                if (groups[i].count() == 0)
+                    continue;
+                Summary const &box = summaries[i];
+                double center = groupCenter(i);
+                appendLine(ret, Point(center - width / 2, valueY(box.median, low, high)), 'h', width);
+                appendLine(ret, Point(center - width / 4, valueY(box.high_whisker, low, high)), 'h', width / 2);
+                appendLine(ret, Point(center, valueY(box.high_whisker, low, high)), 'V', valueY(box.q3, low, high));
+                appendLine(ret, Point(center - width / 4, valueY(box.low_whisker, low, high)), 'h', width / 2);
+                appendLine(ret, Point(center, valueY(box.low_whisker, low, high)), 'V', valueY(box.q1, low, high));
+            }
+            endPath(ret, mark, d_begin, Fill(Color::Transparent).toString() + stroke.toString());
+            return ret;
+        }
+
+        void toScene(Scene &scene) const {
+            double low, high;
+            if (!valueRange(low, high))
+                return;
+
+            double width = groupWidth() * 0.6;
+            for (std::size_t i = 0; i < groups.size(); ++i) {
+                if (groups[i].count() == 0)
+                    continue;
+                Summary box = summary(i);
+                double center = groupCenter(i), top = valueY(box.q3, low, high);
+                scene.add(Scene::RectangleCommand, fill, stroke,
+                          {center - width / 2, top, width, valueY(box.q1, low, high) - top});
+                double const lines[][4] = {
+                        {center - width / 2, box.median, center + width / 2, box.median},
+                        {center, box.high_whisker, center, box.q3},
+                        {center, box.low_whisker, center, box.q1},
+                        {center - width / 4, box.high_whisker, center + width / 4, box.high_whisker},
+                        {center - width / 4, box.low_whisker, center + width / 4, box.low_whisker}};
+                for (auto const &line : lines)
+                    scene.add(Scene::LineCommand, Fill(), stroke,
+                              {line[0], valueY(line[1], low, high), line[2], valueY(line[3], low, high)});
+            }
+        }
+
+    private:
+        static void appendLine(std::string &out, Point const &start, char command, double value) {
+            out += 'M';
+            appendNumber(out, start.x);
+            out += ',';
+            appendNumber(out, start.y);
+            out += command;
+            appendNumber(out, value);
+        }
+    };
+
+    // Violin plots: mirrored Gaussian kernel density outlines, estimated from the retained
+    //  sketch values with Silverman's bandwidth for that many points and evaluated at
+    //  `samples` heights between each group's extremes, so the cost does not depend on the
+    //  number of values.  Outlines form one filled path and the medians one stroked path.
+    class Violin : public DistributionPlot {
+    public:
+        Violin(Rect const &area, Fill const &fill = Fill(Color::Silver), Stroke const &stroke = Stroke(1, Color::Black),
+               unsigned samples = 64, unsigned k = 200)
+                : DistributionPlot(area, fill, stroke, k), samples(std::max(samples, 2u)) {}
+
+        // Density at `samples` evenly spaced values from min() to max() of the group,
+        //  scaled so the largest is 1.
+        std::vector<double> density(std::size_t index) const {
+            QuantileSketch const &sketch = group(index);
+            return density(sketch, sketch.weightedItems());
+        }
+
+        std::string toString() const {
+            double low, high;
+            if (!valueRange(low, high))
+                return "";
+
+            double half_width = groupWidth() * 0.45;
+            std::string ret;
+            std::size_t mark = ret.size();
+            ret += elemStart("path") + "d=\"";
+            std::size_t d_begin = ret.size();
+            std::vector<double> medians(groups.size());
+            for (std::size_t i = 0; i < groups.size(); ++i) {
+                std::vector<Point> outline = this->outline(i, low, high, half_width, medians[i]);
+                for (std::size_t n = 0; n < outline.size(); ++n) {
+                    ret += n == 0 ? 'M' : 'L';
+                    appendNumber(ret, outline[n].x);
+                    ret += ',';
+                    appendNumber(ret, outline[n].y);
+                }
+                if (!outline.empty())
+                    ret += 'z';
+            }
+            endPath(ret, mark, d_begin, styleString());
+
+            mark = ret.size();
+            ret += elemStart("path") + "d=\"";
+            d_begin = ret.size();
+            for (std::size_t i = 0; i < groups.size(); ++i) {
+                if (groups[i].count() == 0)
+                    continue;
+                ret += 'M';
+                appendNumber(ret, groupCenter(i) - half_width / 3);
+                ret += ',';
+                appendNumber(ret, valueY(medians[i], low, high));
+                ret += 'h';
+                appendNumber(ret, half_width * 2 / 3);
+            }
+            endPath(ret, mark, d_begin, Fill(Color::Transparent).toString() + stroke.toString());
+            return ret;
+        }
+
+        void toScene(Scene &scene) const {
+            double low, high;
+            if (!valueRange(low, high))
+                return;
+
+            double half_width = groupWidth() * 0.45;
+            for (std::size_t i = 0; i < groups.size(); ++i) {
+                double median;
+                std::vector<Point> outline = this->outline(i, low, high, half_width, median);
+                if (outline.empty())
+                    continue;
+                scene.add(Scene::PolygonCommand, fill, stroke, outline);
+                double y = valueY(median, low, high);
+                scene.add(Scene::LineCommand, Fill(), stroke,
+                          {groupCenter(i) - half_width / 3, y, groupCenter(i) + half_width / 3, y});
+            }
+        }
+
+    private:
+        unsigned samples;
+
+        std::vector<double> density(QuantileSketch const &sketch,
+                                    std::vector<std::pair<double, std::uint64_t> > const &items) const {
+            std::vector<double> ret(samples, 0);
+            if (items.empty())
+                return ret;
+
+
+            double weight = 0, mean = 0;
+            for (auto const &item : items) {
+                weight += double(item.second);
+                mean += item.first * double(item.second);
+            }
+            mean /= weight;
+            double variance = 0;
+            for (auto const &item : items)
+                variance += (item.first - mean) * (item.first - mean) * double(item.second);
+            double spread = std::sqrt(variance / weight);
+            double const qs[] = {0.25, 0.75};
+            double quartiles[2];
+            sketch.quantiles(items, qs, 2, quartiles);
+            double iqr = (quartiles[1] - quartiles[0]) / 1.34;
+            if (iqr > 0)
+                spread = std::min(spread, iqr);
+            double range = sketch.max() - sketch.min();
+            double bandwidth = 0.9 * spread * std::pow(double(items.size()), -0.2);
+            if (!(bandwidth > range * 1e-3))
+                bandwidth = std::max(range, 1.0) * 1e-3;
+
+            double peak = 0;
+            for (unsigned s = 0; s < samples; ++s) {
+                double value = sketch.min() + range * s / (samples - 1);
+                double sum = 0;
+                for (auto const &item : items) {
+                    double z = (value - item.first) / bandwidth;
+                    sum += double(item.second) * std::exp(-0.5 * z * z);
+                }
+                ret[s] = sum;
+                peak = std::max(peak, sum);
+            }
+            for (auto &value : ret)
+                value /= peak;
+            return ret;
+        }
+
+
+        // Right side from the top down, then the left side back up.  Also gives the median
+        //  from the same sort of the retained values.
+        std::vector<Point> outline(std::size_t index, double low, double high, double half_width, double &median) const {
+            std::vector<Point> ret;
+            QuantileSketch const &sketch = groups[index];
+            median = std::numeric_limits<double>::quiet_NaN();
+            if (sketch.count() == 0)
+                return ret;
+
+            std::vector<std::pair<double, std::uint64_t> > items = sketch.weightedItems();
+            double const half = 0.5;
+            sketch.quantiles(items, &half, 1, &median);
+            std::vector<double> widths = density(sketch, items);
+            double center = groupCenter(index);
+            ret.reserve(samples * 2);
+            for (unsigned s = samples; s-- > 0;)
+                ret.push_back(Point(center + widths[s] * half_width,
+                                    valueY(sketch.min() + (sketch.max() - sketch.min()) * s / (samples - 1), low, high)));
+            for (unsigned s = 0; s < samples; ++s)
+                ret.push_back(Point(center - widths[s] * half_width,
+                                    valueY(sketch.min() + (sketch.max() - sketch.min()) * s / (samples - 1), low, high)));
+            return ret;
+        }
+    };
+
+    // In-place radix-2 FFT of `count` complex values, count a power of two, with twiddles[k]
+    //  = exp(-2 pi i k / count) for k < count / 2.  The inverse transform is unscaled.
+    static inline void fft(std::complex<double> *data, std::size_t count,
+                           std::complex<double> const *twiddles, bool inverse) {
+        for (std::size_t i = 1, j = 0; i < count; ++i) {
+            std::size_t bit = count >> 1;
+            for (; j & bit; bit >>= 1)
+                j ^= bit;
+            j ^= bit;
+            if (i < j)
+                std::swap(data[i], data[j]);
+        }
+        for (std::size_t length = 2; length <= count; length <<= 1) {
+            std::size_t half = length / 2, stride = count / length;
+            for (std::size_t begin = 0; begin < count; begin += length) {
+                for (std::size_t k = 0; k < half; ++k) {
+                    std::complex<double> twiddle = inverse ? std::conj(twiddles[k * stride]) : twiddles[k * stride];
+                    std::complex<double> odd = data[begin + k + half] * twiddle;
+                    data[begin + k + half] = data[begin + k] - odd;
+                    data[begin + k] += odd;
+                }
+            }
+        }
+    }
+
+    static inline std::vector<std::complex<double> > fftTwiddles(std::size_t count) {
+        std::vector<std::complex<double> > ret(count / 2);
+        for (std::size_t k = 0; k < ret.size(); ++k)
+            ret[k] = std::polar(1.0, -6.283185307179586476925 * double(k) / double(count));
+        return ret;
+    }
+
+    // Kernel density estimate of a point cloud, drawn as filled contour bands.  Points are
+    //  binned into a grid over `area` on parallel threads, the grid is convolved with a
+    //  Gaussian through an FFT, and marching squares traces the region above each level as
+    //  one evenodd Path, lowest level first so higher bands paint over lower ones.  Levels
+    //  are spaced evenly up to the peak density, one per fill.  Output size depends on the
+    //  grid only, never on the number of points.
+    class DensityContours : public Shape {
+    public:
+        DensityContours(Rect const &area, std::vector<Fill> const &fills = defaultFills(), unsigned columns = 256,
+                        unsigned rows = 256, double bandwidth = 0)
+                : area(area), fills(fills), columns(std::max(columns, 2u)), rows(std::max(rows, 2u)),
+                  bandwidth(bandwidth), counts(std::size_t(this->columns) * this->rows, 0) {}
+
+        // Points outside the area or not finite are skipped.
+        DensityContours &add(Point const *points, std::size_t count, unsigned threads = 0) {
+            if (threads == 0)
+                threads = std::max(1u, std::thread::hardware_concurrency());
+            std::size_t blocks = std::max<std::size_t>(1, std::min<std::size_t>(threads, count / 65536));
+            std::vector<Moments> moments(blocks);
+            std::vector<std::vector<double> > partials(blocks - 1, std::vector<double>(counts.size(), 0));
+            parallelFor(blocks, [&](std::size_t first, std::size_t last) {
+                for (std::size_t block = first; block < last; ++block) {
+                    std::size_t begin = count * block / blocks, end = count * (block + 1) / blocks;
+                    bin(block == 0 ? counts : partials[block - 1], moments[block], points + begin, end - begin);
+                }
+            }, unsigned(blocks));
+
+            for (auto const &partial : partials)
+                for (std::size_t i = 0; i < counts.size(); ++i)
+                    counts[i] += partial[i];
+            for (auto const &block : moments)
+                statistics += block;
+            return *this;
+        }
+
+        DensityContours &add(std::vector<Point> const &points, unsigned threads = 0) {
+            return add(points.data(), points.size(), threads);
+        }
+
+        // Smoothed density per grid cell, row by row from the top of the area.
+        std::vector<double> density(unsigned threads = 0) const {
+            std::vector<double> ret(counts.size(), 0);
+            if (statistics.count == 0)
+                return ret;
+
+            // Scott's rule per axis unless a bandwidth was given, in cells.
+            double cell_width = area.width() / columns, cell_height = area.height() / rows;
+            double sigma_x = bandwidth / cell_width, sigma_y = bandwidth / cell_height;
+            if (!(bandwidth > 0)) {
+                double factor = std::pow(statistics.count, -1.0 / 6);
+                sigma_x = factor * std::sqrt(std::max(0.0, statistics.variance(statistics.sum_x, statistics.sum_xx)));
+                sigma_y = factor * std::sqrt(std::max(0.0, statistics.variance(statistics.sum_y, statistics.sum_yy)));
+            }
+            sigma_x = std::min(std::max(sigma_x, 0.5), columns / 2.0);
+            sigma_y = std::min(std::max(sigma_y, 0.5), rows / 2.0);
+
+            // Zero padding of four deviations keeps the circular convolution from wrapping.
+            std::size_t width = 1, height = 1;
+            while (width < columns + std::size_t(std::ceil(4 * sigma_x)))
+                width <<= 1;
+            while (height < rows + std::size_t(std::ceil(4 * sigma_y)))
+                height <<= 1;
+            std::vector<std::complex<double> > grid(width * height);
+            std::vector<std::complex<double> > row_twiddles = fftTwiddles(width), column_twiddles = fftTwiddles(height);
+
+            parallelFor(rows, [&](std::size_t begin, std::size_t end) {
+                for (std::size_t row = begin; row < end; ++row) {
+                    for (std::size_t column = 0; column < columns; ++column)
+                        grid[row * width + column] = counts[row * columns + column];
+                    fft(&grid[row * width], width, row_twiddles.data(), false);
+                }
+            }, threads);
+
+            // The Fourier transform of a Gaussian is a Gaussian, applied per column.
+            parallelFor(width, [&](std::size_t begin, std::size_t end) {
+                std::vector<std::complex<double> > line(height);
+                double const two_pi_squared = 19.739208802178717;
+                for (std::size_t column = begin; column < end; ++column) {
+                    for (std::size_t row = 0; row < height; ++row)
+                        line[row] = grid[row * width + column];
+                    fft(line.data(), height, column_twiddles.data(), false);
+
+                    double fx = double(column <= width / 2 ? column : width - column) / width;
+                    for (std::size_t row = 0; row < height; ++row) {
+                        double fy = double(row <= height / 2 ? row : height - row) / height;
+                        line[row] *= std::exp(-two_pi_squared * (sigma_x * sigma_x * fx * fx + sigma_y * sigma_y * fy * fy));
+                    }
+
+                    fft(line.data(), height, column_twiddles.data(), true);
+                    for (std::size_t row = 0; row < rows; ++row)
+                        grid[row * width + column] = line[row];
+                }
+            }, threads);
+
+            double scale = 1.0 / (double(width) * height * statistics.count * cell_width * cell_height);
+            parallelFor(rows, [&](std::size_t begin, std::size_t end) {
+                for (std::size_t row = begin; row < end; ++row) {
+                    fft(&grid[row * width], width, row_twiddles.data(), true);
+                    for (std::size_t column = 0; column < columns; ++column)
+                        ret[row * columns + column] = std::max(0.0, grid[row * width + column].real() * scale);
+                }
+            }, threads);
+            return ret;
+        }
+
+        // One closed, evenodd path per level.
+        std::vector<Path> paths(unsigned threads = 0) const {
+            std::vector<Path> ret;
+            std::vector<double> values = density(threads);
+            double peak = 0;
+            for (double value : values)
+                peak = std::max(peak, value);
+            if (!(peak > 0))
+                return ret;
+
+            for (std::size_t level = 0; level < fills.size(); ++level) {
+                ret.push_back(Path(fills[level], Stroke()));
+                trace(values, peak * (level + 1) / (fills.size() + 1), ret.back());
+            }
+            return ret;
+        }
+
+        std::string toString() const {
+            std::string ret;
+            for (auto const &path : paths())
+                ret += path.toString();
+            return ret;
+        }
+
+        void offset(Point const &offset) {
+            area.minPt.x += offset.x;
+            area.minPt.y += offset.y;
+            area.maxPt.x += offset.x;
+            area.maxPt.y += offset.y;
+        }
+
+        virtual Rect MinMax() const {
+            return area;
+        }
+
+        void collectDefinitions(Definitions &definitions) const {
+            for (auto const &fill : fills)
+                fill.collectDefinitions(definitions);
+        }
+
+        void toScene(Scene &scene) const {
+            for (auto const &path : paths())
+                path.toScene(scene);
+        }
+
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret;
+            ret.objects = sizeof(*this);
+            ret.buffers = vectorMemory(counts) + vectorMemory(fills);
+            return ret;
+        }
+
+    private:
+        // Running sums of the binned points in cell units, for the automatic bandwidth.  Cell
+        //  coordinates stay within the grid, so the variance does not cancel for areas far
+        //  from the origin.
+        struct Moments {
+            double count = 0, sum_x = 0, sum_y = 0, sum_xx = 0, sum_yy = 0;
+
+            Moments &operator+=(Moments const &other) {
+                count += other.count;
+                sum_x += other.sum_x;
+                sum_y += other.sum_y;
+                sum_xx += other.sum_xx;
+                sum_yy += other.sum_yy;
+                return *this;
+            }
+
+            double variance(double sum, double sum_squares) const {
+                double mean = sum / count;
+                return sum_squares / count - mean * mean;
+            }
+        };
+
+        Rect area;
+        std::vector<Fill> fills;
+        unsigned columns, rows;
+        double bandwidth;
+        std::vector<double> counts;
+        Moments statistics;
+
+        static std::vector<Fill> defaultFills() {
+            std::vector<Fill> ret;
+            for (int level = 0; level < 6; ++level)
+                ret.push_back(Fill(Color(222 - 40 * level, 235 - 30 * level, 247 - 14 * level)));
+            return ret;
+        }
+
+        void bin(std::vector<double> &target, Moments &moments, Point const *points, std::size_t count) const {
+            double x_scale = columns / area.width(), y_scale = rows / area.height();
+            for (std::size_t i = 0; i < count; ++i) {
+                double x = (points[i].x - area.minPt.x) * x_scale, y = (points[i].y - area.minPt.y) * y_scale;
+                if (!(x >= 0 && x < columns && y >= 0 && y < rows))
+                    continue;
+
+                target[std::size_t(y) * columns + std::size_t(x)] += 1;
+                moments.count += 1;
+                moments.sum_x += x;
+                moments.sum_y += y;
+                moments.sum_xx += x * x;
+                moments.sum_yy += y * y;
+            }
+        }
+
+        // Marching squares over the cell centers, padded with zeros so every contour closes.
+        //  Each crossing of a grid edge has exactly two neighbors, and the rings are followed
+        //  through them; saddles are resolved by the average of the four corners.
+        void trace(std::vector<double> const &values, double threshold, Path &path) const {
+            std::size_t width = columns + 2, height = rows + 2;
+            auto value = [&](std::size_t row, std::size_t column) {
+                if (row == 0 || column == 0 || row > rows || column > columns)
+                    return 0.0;
+                return values[(row - 1) * columns + column - 1];
+            };
+
+            // Edge e of the padded grid: 2 * (row * width + column) runs right of the node,
+            //  + 1 runs down.
+            std::uint32_t const none = 0xFFFFFFFFu;
+            std::vector<std::uint32_t> links(width * height * 4, none);
+            auto link = [&](std::uint32_t a, std::uint32_t b) {
+                links[a * 2 + (links[a * 2] != none)] = b;
+                links[b * 2 + (links[b * 2] != none)] = a;
+            };
+
+            for (std::size_t row = 0; row + 1 < height; ++row) {
+                for (std::size_t column = 0; column + 1 < width; ++column) {
+                    double corners[4] = {value(row, column), value(row, column + 1),
+                                         value(row + 1, column + 1), value(row + 1, column)};
+                    unsigned state = (corners[0] >= threshold) | (corners[1] >= threshold) << 1
+                                     | (corners[2] >= threshold) << 2 | (corners[3] >= threshold) << 3;
+                    if (state == 0 || state == 15)
+                        continue;
+
+                    std::uint32_t top = std::uint32_t(2 * (row * width + column));
+                    std::uint32_t left = top + 1;
+                    std::uint32_t right = std::uint32_t(2 * (row * width + column + 1) + 1);
+                    std::uint32_t bottom = std::uint32_t(2 * ((row + 1) * width + column));
+                    if (state == 5 || state == 10) {
+                        bool center = (corners[0] + corners[1] + corners[2] + corners[3]) / 4 >= threshold;
+                        if ((state == 5) == center) {
+                            link(top, right);
+                            link(bottom, left);
+                        }
+                        else {
+                            link(left, top);
+                            link(right, bottom);
+                        }
+                        continue;
+                    }
+
+                    std::uint32_t crossed[2], n = 0;
+                    if ((state & 1) != (state >> 1 & 1))
+                        crossed[n++] = top;
+                    if ((state >> 1 & 1) != (state >> 2 & 1))
+                        crossed[n++] = right;
+                    if ((state >> 2 & 1) != (state >> 3 & 1))
+                        crossed[n++] = bottom;
+                    if ((state >> 3 & 1) != (state & 1))
+                        crossed[n++] = left;
+                    link(crossed[0], crossed[1]);
+                }
+            }
+
+            double cell_width = area.width() / columns, cell_height = area.height() / rows;
+            auto crossing = [&](std::uint32_t edge) {
+                std::size_t node = edge / 2, row = node / width, column = node % width;
+                double a = value(row, column);
+                double b = edge & 1 ? value(row + 1, column) : value(row, column + 1);
+                double t = (threshold - a) / (b - a);
+                return Point(area.minPt.x + (column - 0.5 + (edge & 1 ? 0 : t)) * cell_width,
+                             area.minPt.y + (row - 0.5 + (edge & 1 ? t : 0)) * cell_height);
+            };
+
+            std::vector<char> visited(width * height * 2, 0);
+            for (std::uint32_t start = 0; start < visited.size(); ++start) {
+                if (visited[start] || links[start * 2] == none)
+                    continue;
+
+                std::uint32_t previous = none, current = start;
+                do {
+                    visited[current] = 1;
+                    path << crossing(current);
+                    std::uint32_t next = links[current * 2] != previous ? links[current * 2] : links[current * 2 + 1];
+                    previous = current;
+                    current = next;
+                } while (current != start && current != none && !visited[current]);
+                path.startNewSubPath();
+            }
+        }
+    };
+
+    // XML declaration and doctype preceding a standalone document.
+    static std::string documentProlog() {
+        std::stringstream ss;
+        ss << "<?xml " << attribute("version", "1.0") << attribute("standalone", "no")
+           << "?>\n<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" "
+           << "\"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n";
+        return ss.str();
+    }
+
+    // Opening <svg> element whose viewBox covers the given region.
+    static std::string svgStart(Rect const &region) {
+        std::stringstream ss;
+        ss << "<svg "
+           << attribute("width", region.width(), "px")
+           << attribute("height", region.height(), "px")
+           << attribute("xmlns", "http://www.w3.org/2000/svg")
+           << attribute("xmlns:xlink", "http://www.w3.org/1999/xlink")
+           << attribute("viewBox",
+                        std::to_string(region.minPt.x) + " " +
+                        std::to_string(region.minPt.y) + " " +
+                        std::to_string(region.width()) + " " +
+                        std::to_string(region.height()))
+           << attribute("version", "1.1") << ">\n";
+        return ss.str();
+    }
+
+    class Document {
+    public:
+        Document(std::string const &file_name, Layout layout = Layout())
+                : file_name(file_name), layout(layout) {}
+
+        Rect region;
+
+        Document &operator<<(Shape const &shape) {
+            std::size_t body_size = body_nodes_str.size();
+            std::size_t definition_count = definitions.size();
+
+            if (reorder)
+                addSorted(shape);
+            else
+                body_nodes_str += shape.toString();
+            region.include(shape.MinMax());
+            shape.collectDefinitions(definitions);
+
+            if (listener.callback)
+                notify(reorder ? shape.toString() : body_nodes_str.substr(body_size), definition_count);
+            return *this;
+        }
+
+        // Opt-in for documents whose drawing order does not matter, e.g. non-overlapping tiles.
+        //  Shapes appended from now on are stably sorted by (type, style) when the document is
+        //  written, and runs of the same style share one <g> carrying the presentation
+        //  attributes.  Besides being smaller, sorted output compresses much better.  Disabling
+        //  it again writes the sorted shapes out, so shapes appended afterwards paint on top.
+        Document &reorderByStyle(bool enable = true) {
+            if (reorder && !enable)
+                flushSorted();
+            reorder = enable;
+            return *this;
+        }
+
+        // Called with the markup of every appended shape, preceded by a <defs> element when the
+        //  shape introduced new definitions.  Used by PreviewServer, copies of the document do
+        //  not inherit it.
+        void setListener(std::function<void(std::string const &)> const &callback) {
+            listener.callback = callback;
+        }
+
+        // CSS rule applying to the document, e.g. "text { font-weight: bold; }".
+        Document &addStyle(std::string const &rule) {
+            std::shared_ptr<Definition> definition = std::make_shared<Definition>();
+            std::stringstream id;
+            id << "style" << std::hex << hashString(rule);
+            definition->id = id.str();
+            definition->content = rule + "\n";
+            styles.add(definition);
+            return *this;
+        }
+
+        std::string toString() const {
+
+            std::stringstream ss;
+            ss << documentProlog() << svgStart(region) << defsString()
+               << nodesString() << elemEnd("svg");
+            return ss.str();
+        }
+
+        // The <svg> element only, for embedding into a page that provides the definitions.
+        std::string inlineString() const {
+            return svgStart(region) + nodesString() + elemEnd("svg");
+        }
+
+        // Children of the <svg> element: definitions followed by the shapes.
+        std::string contentString() const {
+            return defsString() + nodesString();
+        }
+
+        Definitions const &getDefinitions() const { return definitions; }
+
+        MemoryUsage memoryUsage() const {
+            MemoryUsage ret;
+            ret.objects = sizeof(*this);
+            ret.strings = stringMemory(file_name) + stringMemory(body_nodes_str) + stringMemory(sorted_nodes_str);
+
+            MemoryUsage definition_usage = definitions.memoryUsage();
+            definition_usage += styles.memoryUsage();
+            ret.definitions = definition_usage.definitions;
+            ret.buffers = definition_usage.buffers;
+
+            ret.buffers += vectorMemory(sorted_offsets) + vectorMemory(sorted_keys) + vectorMemory(sorted_styles)
+                           + vectorMemory(sorted_groupable) + hashMemory(sorted_style_index)
+                           + hashMemory(sorted_type_index);
+            for (auto const &style : sorted_styles)
+                ret.strings += stringMemory(style) * 2;
+            return ret;
+        }
+
+        Definitions const &getStyles() const { return styles; }
+
+        bool save() const {
+            std::ofstream ofs(file_name.c_str());
+            if (!ofs.good())
+                return false;
+
+            ofs << toString();
+            ofs.close();
+            return true;
+        }
+
+    private:
+        std::string file_name;
+        Layout layout;
+
+        std::string body_nodes_str;
+        Definitions definitions;
+        Definitions styles;
+        // Copies of a document start without the listener, which belongs to the original.
+        struct Listener {
+            Listener() {}
+            Listener(Listener const &) {}
+            Listener(Listener &&other) : callback(std::move(other.callback)) {}
+
+            Listener &operator=(Listener const &) {
+                callback = nullptr;
+                return *this;
+            }
+
+            Listener &operator=(Listener &&other) {
+                callback = std::move(other.callback);
+                return *this;
+            }
+
+            std::function<void(std::string const &)> callback;
+        } listener;
+
+        // Shapes collected for reordering, the markup of shape i without its style is
+        //  sorted_nodes_str[sorted_offsets[i], sorted_offsets[i + 1]).
+        bool reorder = false;
+        std::string sorted_nodes_str;
+        std::vector<std::size_t> sorted_offsets;
+        std::vector<std::uint64_t> sorted_keys;
+        std::vector<std::string> sorted_styles;
+        std::vector<char> sorted_groupable;
+        std::unordered_map<std::string, std::uint32_t> sorted_style_index;
+        std::unordered_map<std::type_index, std::uint32_t> sorted_type_index;
+
+        void notify(std::string const &markup, std::size_t definition_count) const {
+            std::string fragment;
+            if (definitions.size() > definition_count) {
+                fragment = "<defs>\n";
+                for (std::size_t i = definition_count; i < definitions.size(); ++i)
+                    fragment += definitions.items()[i]->content;
+                fragment += elemEnd("defs");
+            }
+            listener.callback(fragment + markup);
+        }
+
+        void addSorted(Shape const &shape) {
+            std::string style = shape.styleString();
+            // vector-effect is not inherited, such shapes keep their attributes.
+            std::string bare = style.find("vector-effect") == std::string::npos ? shape.bareString() : "";
+            bool groupable = !bare.empty();
+            if (!groupable)
+                bare = shape.toString();
+
+            std::string style_key = (groupable ? "g" : "u") + style;
+            auto style_id = sorted_style_index.insert(
+                    std::make_pair(style_key, std::uint32_t(sorted_styles.size())));
+            if (style_id.second) {
+                sorted_styles.push_back(style);
+                sorted_groupable.push_back(groupable);
+            }
+            auto type_id = sorted_type_index.insert(
+                    std::make_pair(std::type_index(typeid(shape)), std::uint32_t(sorted_type_index.size())));
+
+            sorted_keys.push_back((std::uint64_t(type_id.first->second) << 32) | style_id.first->second);
+            sorted_offsets.push_back(sorted_nodes_str.size());
+            sorted_nodes_str += bare;
+        }
+
+        std::string nodesString() const {
+            if (sorted_keys.empty())
+                return body_nodes_str;
+
+            std::string ret = body_nodes_str;
+            appendSorted(ret);
+            return ret;
+        }
+
+        // Moves the shapes collected for reordering into the body.
+        void flushSorted() {
+            appendSorted(body_nodes_str);
+            sorted_nodes_str.clear();
+            sorted_offsets.clear();
+            sorted_keys.clear();
+            sorted_styles.clear();
+            sorted_groupable.clear();
+            sorted_style_index.clear();
+            sorted_type_index.clear();
+        }
+
+        void appendSorted(std::string &ret) const {
+            std::vector<std::uint64_t> keys = sorted_keys;
+            std::vector<std::uint32_t> order(keys.size());
+            for (std::size_t i = 0; i < order.size(); ++i)
+                order[i] = std::uint32_t(i);
+            radixSort(keys, order);
+
+            ret.reserve(ret.size() + sorted_nodes_str.size() + sorted_styles.size() * 64);
+            for (std::size_t i = 0; i < order.size();) {
+                std::uint32_t style_id = std::uint32_t(keys[i]);
+                bool group = sorted_groupable[style_id] && !sorted_styles[style_id].empty();
+                if (group)
+                    ret += "<g " + sorted_styles[style_id] + ">\n";
+
+                for (; i < order.size() && std::uint32_t(keys[i]) == style_id; ++i) {
+                    std::size_t begin = sorted_offsets[order[i]];
+                    std::size_t end = order[i] + 1 < sorted_offsets.size() ? sorted_offsets[order[i] + 1]
+                                                                            : sorted_nodes_str.size();
+                    ret.append(sorted_nodes_str, begin, end - begin);
+                }
+
+                if (group)
+                    ret += elemEnd("g");
+            }
+        }
+
+        std::string defsString() const {
+            if (styles.empty())
+                return definitions.toString();
+
+            return "<defs>\n<style type=\"text/css\"><![CDATA[\n" + styles.contentString() + "]]></style>\n"
+                   + definitions.contentString() + elemEnd("defs");
+        }
+    };
+
+#ifdef SVG_PREVIEW_SERVER
+    // Live preview of a document in the browser.  A single threaded epoll HTTP server on
+    //  localhost serves a viewer page, which receives the document once and then every
+    //  appended shape as a server-sent event, so nothing is re-downloaded or re-parsed.
+    //  The server runs on the caller's thread and only does network I/O inside poll():
+    //  appending shapes just buffers them, so call poll() now and then while building the
+    //  document and to keep serving once it is complete.  Linux only.
+    class PreviewServer {
+    public:
+        PreviewServer() : listen_fd(-1), epoll_fd(-1), document(nullptr) {}
+
+        ~PreviewServer() {
+            if (document)
+                document->setListener(nullptr);
+            for (auto const &client : clients)
+                ::close(client.first);
+            if (listen_fd >= 0)
+                ::close(listen_fd);
+            if (epoll_fd >= 0)
+                ::close(epoll_fd);
+        }
+
+        // Start listening on 127.0.0.1, returns false if the port cannot be bound.
+        bool listen(unsigned short port = 8080) {
+            listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (listen_fd < 0)
+                return false;
+
+            int reuse = 1;
+            ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+            sockaddr_in address;
+            std::memset(&address, 0, sizeof(address));
+            address.sin_family = AF_INET;
+            address.sin_port = htons(port);
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if (::bind(listen_fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 ||
+                ::listen(listen_fd, 16) != 0)
+                return false;
+
+            epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+            return epoll_fd >= 0 && watch(listen_fd, EPOLLIN, EPOLL_CTL_ADD);
+        }
+
+        // Show the document, shapes appended to it from now on are pushed to the viewers.  The
+        //  document has to outlive the server.
+        void attach(Document &attached) {
+            if (document)
+                document->setListener(nullptr);
+            document = &attached;
+            document->setListener([this](std::string const &fragment) { publish(fragment); });
+            broadcastReset();
+        }
+
+        // Service connections for up to timeout_ms milliseconds (-1 blocks until activity).
+        void poll(int timeout_ms = 0) {
+            flushPending();
+            if (epoll_fd < 0)
+                return;
+
+            epoll_event events[64];
+            int count = ::epoll_wait(epoll_fd, events, 64, timeout_ms);
+            for (int i = 0; i < count; ++i) {
+                // Handling an earlier event of the batch may have dropped this client already.
+                int fd = events[i].data.fd;
+                if (fd == listen_fd)
+                    accept();
+                else if (!clients.count(fd))
+                    continue;
+                else if (events[i].events & (EPOLLERR | EPOLLHUP))
+                    drop(fd);
+                else {
+                    if (events[i].events & EPOLLIN)
+                        receive(fd);
+                    if ((events[i].events & EPOLLOUT) && clients.count(fd))
+                        send(fd);
+                }
+            }
+        }
+
+    private:
+        struct Client {
+            Client() : streaming(false), close_when_sent(false) {}
+
+            std::string request;
+            std::string pending;
+            bool streaming;
+            bool close_when_sent;
+        };
+
+        // Viewers that fall this far behind are disconnected and have to reload.
+        static const std::size_t max_backlog = std::size_t(256) << 20;
+
+        int listen_fd;
+        int epoll_fd;
+        Document *document;
+        std::string pending_shapes;
+        std::string last_view_box;
+        std::unordered_map<int, Client> clients;
+
+        // Runs inside Document::operator<<, so it only buffers: the shapes go out as one event
+        //  on the next poll().
+        void publish(std::string const &fragment) {
+            pending_shapes += fragment;
+        }
+
+        void flushPending() {
+            if (!document)
+                return;
+
+            std::string events;
+            std::string view_box = viewBoxString();
+            if (view_box != last_view_box) {
+                events += event("viewbox", view_box);
+                last_view_box = view_box;
+            }
+            if (!pending_shapes.empty())
+                events += event("shape", pending_shapes);
+            pending_shapes.clear();
+
+            if (!events.empty())
+                broadcast(events);
+        }
+
+        void broadcastReset() {
+            pending_shapes.clear();
+            last_view_box = viewBoxString();
+            std::string events = event("viewbox", last_view_box) + event("reset", document->contentString());
+            broadcast(events);
+        }
+
+        void broadcast(std::string const &events) {
+            std::vector<int> streaming;
+            for (auto const &client : clients)
+                if (client.second.streaming)
+                    streaming.push_back(client.first);
+            for (int fd : streaming)
+                queue(fd, events);
+        }
+
+        std::string viewBoxString() const {
+            std::string ret;
+            appendNumber(ret, document->region.minPt.x);
+            ret += " ";
+            appendNumber(ret, document->region.minPt.y);
+            ret += " ";
+            appendNumber(ret, document->region.width());
+            ret += " ";
+            appendNumber(ret, document->region.height());
+            return ret;
+        }
+
+        // Server-sent event, every line of the payload becomes a data field.
+        static std::string event(std::string const &name, std::string const &data) {
+            std::string ret = "event: " + name + "\n";
+            std::size_t begin = 0;
+            while (begin < data.size()) {
+                std::size_t end = data.find('\n', begin);
+                if (end == std::string::npos)
+                    end = data.size();
+                ret += "data: ";
+                ret.append(data, begin, end - begin);
+                ret += "\n";
+                begin = end + 1;
+            }
+            if (data.empty())
+                ret += "data:\n";
+            return ret + "\n";
+        }
+
+        bool watch(int fd, std::uint32_t events, int operation) {
+            epoll_event event;
+            event.events = events;
+            event.data.fd = fd;
+            return ::epoll_ctl(epoll_fd, operation, fd, &event) == 0;
+        }
+
+        void accept() {
+            for (;;) {
+                int fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0)
+                    return;
+                if (!watch(fd, EPOLLIN, EPOLL_CTL_ADD)) {
+                    ::close(fd);
+                    continue;
+                }
+                clients[fd] = Client();
+            }
+        }
+
+        void drop(int fd) {
+            ::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+            ::close(fd);
+            clients.erase(fd);
+        }
+
+        void receive(int fd) {
+            auto found = clients.find(fd);
+            if (found == clients.end())
+                return;
+            Client &client = found->second;
+            char buffer[4096];
+            for (;;) {
+                ssize_t length = ::recv(fd, buffer, sizeof(buffer), 0);
+                if (length == 0 || (length < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    drop(fd);
+                    return;
+                }
+                if (length < 0)
+                    break;
+                client.request.append(buffer, length);
+            }
+
+            if (client.streaming || client.request.find("\r\n\r\n") == std::string::npos) {
+                if (client.request.size() > 65536)
+                    drop(fd);
+                return;
+            }
+
+            std::string path;
+            std::istringstream request_line(client.request);
+            std::string method;
+            request_line >> method >> path;
+            client.request.clear();
+
+            if (method != "GET")
+                respond(fd, "405 Method Not Allowed", "text/plain", "");
+            else if (path == "/")
+                respond(fd, "200 OK", "text/html; charset=utf-8", viewerPage());
+            else if (path == "/document.svg")
+                respond(fd, "200 OK", "image/svg+xml", document ? document->toString() : "");
+            else if (path == "/events") {
+                // The header goes out before the client receives broadcasts, and pending shapes
+                //  are flushed to the other clients first since the reset already holds them.
+                queue(fd, "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+                          "Cache-Control: no-cache\r\nConnection: keep-alive\r\n\r\n");
+                if (!clients.count(fd))
+                    return;
+                if (document)
+                    flushPending();
+                clients[fd].streaming = true;
+                if (document)
+                    queue(fd, event("viewbox", viewBoxString()) + event("reset", document->contentString()));
+            } else
+                respond(fd, "404 Not Found", "text/plain", "");
+        }
+
+        void respond(int fd, std::string const &status, std::string const &content_type, std::string const &body) {
+            clients[fd].close_when_sent = true;
+            queue(fd, "HTTP/1.1 " + status + "\r\nContent-Type: " + content_type + "\r\nContent-Length: " +
+                      std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body);
+        }
+
+        void queue(int fd, std::string const &data) {
+            Client &client = clients[fd];
+            bool was_idle = client.pending.empty();
+            client.pending += data;
+            if (client.pending.size() > max_backlog) {
+                drop(fd);
+                return;
+            }
+            send(fd);
+            if (was_idle && clients.count(fd) && !clients[fd].pending.empty())
+                watch(fd, EPOLLIN | EPOLLOUT, EPOLL_CTL_MOD);
+        }
+
+        void send(int fd) {
+            Client &client = clients[fd];
+            std::size_t sent = 0;
+            while (sent < client.pending.size()) {
+                ssize_t length = ::send(fd, client.pending.data() + sent, client.pending.size() - sent, MSG_NOSIGNAL);
+                if (length < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        break;
+                    drop(fd);
+                    return;
+                }
+                sent += length;
+            }
+            client.pending.erase(0, sent);
+
+            if (client.pending.empty()) {
+                if (client.close_when_sent)
+                    drop(fd);
+                else
+                    watch(fd, EPOLLIN, EPOLL_CTL_MOD);
+            }
+        }
+
+        static std::string viewerPage() {
+            return
+                "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>simple-svg preview</title></head>\n"
+                "<body style=\"margin:0\">\n"
+                "<svg id=\"view\" xmlns=\"http://www.w3.org/2000/svg\" style=\"width:100vw;height:100vh\"></svg>\n"
+                "<script>\n"
+                "var view = document.getElementById('view'), source = new EventSource('/events');\n"
+                "function append(markup) {\n"
+                "  var parsed = new DOMParser().parseFromString(\n"
+                "    '<svg xmlns=\"http://www.w3.org/2000/svg\" xmlns:xlink=\"http://www.w3.org/1999/xlink\">' + markup +\n"
+                "    '</svg>', 'image/svg+xml');\n"
+                "  var fragment = document.createDocumentFragment();\n"
+                "  while (parsed.documentElement.firstChild)\n"
+                "    fragment.appendChild(document.adoptNode(parsed.documentElement.firstChild));\n"
+                "  view.appendChild(fragment);\n"
+                "}\n"
+                "source.addEventListener('reset', function (e) { view.textContent = ''; append(e.data); });\n"
+                "source.addEventListener('shape', function (e) { append(e.data); });\n"
+                "source.addEventListener('viewbox', function (e) { view.setAttribute('viewBox', e.data); });\n"
+                "</script>\n</body></html>\n";
+        }
+    };
+#endif
+
+#ifdef SVG_HAS_COROUTINES
+    // Lazily produced sequence (C++20), e.g. a Generator<Shape const &> coroutine yielding
+    //  temporaries: each one lives until the consumer resumes the coroutine.
+    template<typename T>
+    class Generator {
+    public:
+        typedef typename std::remove_reference<T>::type value_type;
+
+        struct promise_type {
+            value_type *current = nullptr;
+            std::exception_ptr error;
+
+            Generator get_return_object() {
+                return Generator(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            std::suspend_always final_suspend() noexcept { return {}; }
+
+            std::suspend_always yield_value(value_type &value) noexcept {
+                current = std::addressof(value);
+                return {};
+            }
+
+            std::suspend_always yield_value(typename std::remove_const<value_type>::type &&value) noexcept {
+                current = std::addressof(value);
+                return {};
+            }
+
+            void return_void() {}
+
+            void unhandled_exception() { error = std::current_exception(); }
+        };
+
+        class iterator {
+        public:
+            iterator(std::coroutine_handle<promise_type> coroutine = nullptr) : coroutine(coroutine) {}
+
+            value_type &operator*() const { return *coroutine.promise().current; }
+
+            iterator &operator++() {
+                resume(coroutine);
+                return *this;
+            }
+
+            bool operator==(iterator const &other) const { return done() == other.done(); }
+
+            bool operator!=(iterator const &other) const { return !(*this == other); }
+
+        private:
+            std::coroutine_handle<promise_type> coroutine;
+
+            bool done() const { return !coroutine || coroutine.done(); }
+        };
+
+        Generator(Generator &&other) noexcept : coroutine(other.coroutine) { other.coroutine = nullptr; }
+
+        Generator &operator=(Generator &&other) noexcept {
+            std::swap(coroutine, other.coroutine);
+            return *this;
+        }
+
+        Generator(Generator const &) = delete;
+
+        ~Generator() {
+            if (coroutine)
+                coroutine.destroy();
+        }
+
+        iterator begin() {
+            resume(coroutine);
+            return iterator(coroutine);
+        }
+
+        iterator end() { return iterator(); }
+
+    private:
+        std::coroutine_handle<promise_type> coroutine;
+
+        explicit Generator(std::coroutine_handle<promise_type> coroutine) : coroutine(coroutine) {}
+
+        static void resume(std::coroutine_handle<promise_type> coroutine) {
+            coroutine.resume();
+            if (coroutine.promise().error)
+                std::rethrow_exception(coroutine.promise().error);
+        }
+    };
+#endif
+
+    // Document written to a stream while it is built, so memory use does not grow with the
+    //  number of shapes.  The viewBox is fixed up front from the layout dimensions and the
+    //  definitions are written last, SVG allows references to definitions further down.
+    class StreamingDocument {
+    public:
+        StreamingDocument(std::ostream &out, Layout const &layout = Layout(),
+                          std::size_t flush_size = std::size_t(1) << 16)
+                : out(out), flush_size(flush_size), closed(false) {
+            buffer = documentProlog() + svgStart(Rect(Point(0, 0), layout.dimensions.width,
+                                                      layout.dimensions.height));
+        }
+
+        ~StreamingDocument() { close(); }
+
+        // Bounds of the shapes written so far.
+        Rect region;
+
+        StreamingDocument &operator<<(Shape const &shape) {
+            buffer += shape.toString();
+            region.include(shape.MinMax());
+            shape.collectDefinitions(definitions);
+            ++count;
+
+            // Write out between shapes, a generator is suspended meanwhile.
+            if (buffer.size() >= flush_size)
+                flush();
+            return *this;
+        }
+
+#ifdef SVG_HAS_COROUTINES
+        // Pull every shape of the generator, each one is serialized and discarded before the
+        //  next is produced.
+        StreamingDocument &operator<<(Generator<Shape const &> &&shapes) {
+            for (Shape const &shape : shapes)
+                *this << shape;
+            return *this;
+        }
+#endif
+
+        std::size_t shapeCount() const { return count; }
+
+        void flush() {
+            out.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+
+        // Finish the document, called by the destructor if needed.  Returns the stream state.
+        bool close() {
+            if (!closed) {
+                buffer += definitions.toString() + elemEnd("svg");
+                flush();
+                out.flush();
+                closed = true;
+            }
+            return out.good();
+        }
+
+    private:
+        std::ostream &out;
+        std::size_t flush_size;
+        bool closed;
+        std::size_t count = 0;
+        std::string buffer;
+        Definitions definitions;
+    };
+
+    // Dynamic shapes of a single animation frame.
+    class Frame {
+    public:
+        Frame() {}
+
+        Frame &operator<<(Shape const &shape) {
+            body_nodes_str += shape.toString();
+            region.include(shape.MinMax());
+            shape.collectDefinitions(definitions);
+            return *this;
+        }
+
+        Rect region;
+        Definitions definitions;
+        std::string body_nodes_str;
+    };
+
+    // Sequence of frames drawn over shared static geometry.  Static shapes are serialized once,
+    //  and the output is either a single SMIL animated document or one file per frame.
+    class Animation {
+    public:
+        Animation(double frame_duration = .1, bool repeat = true)
+                : frame_duration(frame_duration), repeat(repeat) {}
+
+        Rect region;
+
+        // Static shapes, visible in every frame.
+        Animation &operator<<(Shape const &shape) {
+            static_nodes_str += shape.toString();
+            region.include(shape.MinMax());
+            shape.collectDefinitions(definitions);
+            return *this;
+        }
+
+        Frame &addFrame() {
+            frames.push_back(Frame());
+            return frames.back();
+        }
+
+        // Append `count` frames, build(frame, index) is called for each one in parallel and
+        //  must therefore be safe to call concurrently.
+        void addFrames(std::size_t count, std::function<void(Frame &, std::size_t)> const &build,
+                       unsigned threads = 0) {
+            std::size_t first = frames.size();
+            frames.resize(first + count);
+            parallelFor(count, [this, first, &build](std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; ++i)
+                    build(frames[first + i], i);
+            }, threads);
+        }
+
+        std::size_t frameCount() const { return frames.size(); }
+
+        std::string toString() const {
+            std::string ret = staticPrefix();
+            for (std::size_t i = 0; i < frames.size(); ++i) {
+                std::stringstream ss;
+                ss << "<g " << attribute("display", frames.size() == 1 ? "inline" : "none") << ">\n";
+                if (frames.size() > 1) {
+                    std::stringstream values, key_times;
+                    if (i > 0) {
+                        values << "none;";
+                        key_times << "0;";
+                    }
+                    values << "inline";
+                    key_times << double(i) / frames.size();
+                    if (i + 1 < frames.size()) {
+                        values << ";none";
+                        key_times << ";" << double(i + 1) / frames.size();
+                    }
+
+                    ss << elemStart("animate") << attribute("attributeName", "display")
+                       << attribute("values", values.str()) << attribute("keyTimes", key_times.str())
+                       << attribute("dur", frame_duration * frames.size(), "s") << attribute("calcMode", "discrete")
+                       << attribute("repeatCount", repeat ? "indefinite" : "1")
+                       << (repeat ? "" : attribute("fill", "freeze")) << emptyElemEnd();
+                }
+                ret += ss.str();
+                ret += frames[i].body_nodes_str;
+                ret += elemEnd("g");
+            }
+            return ret + elemEnd("svg");
+        }
+
+        bool save(std::string const &file_name) const {
+            std::ofstream ofs(file_name.c_str());
+            if (!ofs.good())
+                return false;
+
+            ofs << toString();
+            ofs.close();
+            return true;
+        }
+
+        // Write one standalone document per frame.  The file name is built from a printf
+        //  pattern taking the frame index, e.g. "frame_%05d.svg".  Every file starts with the
+        //  same prefix bytes, serialized once, and files are written in parallel.  Returns
+        //  false without writing anything unless the pattern has exactly one integer
+        //  conversion, so that every frame gets a file name of its own.
+        bool saveFrames(std::string const &file_name_pattern, unsigned threads = 0) const {
+            if (!isFramePattern(file_name_pattern))
+                return false;
+
+            std::string const prefix = staticPrefix();
+            std::string const suffix = elemEnd("svg");
+
+            std::vector<char> results(frames.size(), 0);
+            parallelFor(frames.size(), [&](std::size_t begin, std::size_t end) {
+                std::vector<char> file_name;
+                for (std::size_t i = begin; i < end; ++i) {
+                    int length = std::snprintf(nullptr, 0, file_name_pattern.c_str(), int(i));
+                    file_name.resize(std::size_t(std::max(length, 0)) + 1);
+                    std::snprintf(file_name.data(), file_name.size(), file_name_pattern.c_str(), int(i));
+                    std::ofstream ofs(file_name.data(), std::ios::binary);
+                    if (!ofs.good())
+                        continue;
+
+                    ofs.write(prefix.data(), prefix.size());
+                    ofs.write(frames[i].body_nodes_str.data(), frames[i].body_nodes_str.size());
+                    ofs.write(suffix.data(), suffix.size());
+                    results[i] = ofs.good();
+                }
+            }, threads);
+
+            return std::find(results.begin(), results.end(), 0) == results.end();
+        }
+
+    private:
+        double frame_duration;
+        bool repeat;
+        std::string static_nodes_str;
+        Definitions definitions;
+        std::vector<Frame> frames;
+
+        // True for patterns with one int conversion (d, i, o, u, x or X, with flags, width and
+        //  precision but no '*' or length modifier) and otherwise only "%%".
+        static bool isFramePattern(std::string const &pattern) {
+            int conversions = 0;
+            for (std::size_t i = 0; i < pattern.size(); ++i) {
+                if (pattern[i] != '%')
+                    continue;
+                if (++i < pattern.size() && pattern[i] == '%')
+                    continue;
+
+                i = pattern.find_first_not_of("-+ #0", i);
+                i = pattern.find_first_not_of("0123456789", i);
+                if (i < pattern.size() && pattern[i] == '.')
+                    i = pattern.find_first_not_of("0123456789", i + 1);
+                if (i >= pattern.size() || std::string("diouxX").find(pattern[i]) == std::string::npos)
+                    return false;
+                ++conversions;
+            }
+            return conversions == 1;
+        }
+
+        // Everything up to the dynamic part of a frame.  The viewBox and definitions cover all
+        //  frames so the prefix is identical for each of them.
+        std::string staticPrefix() const {
+            Rect all = region;
+            Definitions all_definitions = definitions;
+            for (auto const &frame : frames) {
+                all.include(frame.region);
+                all_definitions.add(frame.definitions);
+            }
+
+            return documentProlog() + svgStart(all) + all_definitions.toString() + static_nodes_str;
+        }
+    };
+
+    // Writes many documents into one HTML page.  Definitions and style rules are hoisted into
+    //  a single shared block and the per document XML prolog is skipped.
+    class Bundle {
+    public:
+        Bundle(std::string const &file_name, std::string const &title = "")
+                : file_name(file_name), title(title) {}
+
+        Bundle &operator<<(Document const &document) {
+            documents.push_back(document);
+            return *this;
+        }
+
+        Bundle &operator<<(Document &&document) {
+            documents.push_back(std::move(document));
+            return *this;
+        }
+
+        std::size_t size() const { return documents.size(); }
+
+        // Documents are serialized in parallel, then written in insertion order.
+        std::string toString(unsigned threads = 0) const {
+            Definitions definitions;
+            Definitions styles;
+            for (auto const &document : documents) {
+                definitions.add(document.getDefinitions());
+                styles.add(document.getStyles());
+            }
+
+            std::vector<std::string> parts(documents.size());
+            parallelFor(documents.size(), [this, &parts](std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; ++i)
+                    parts[i] = documents[i].inlineString();
+            }, threads);
+
+            std::string ret = "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\">\n";
+            if (!title.empty())
+                ret += "<title>" + title + "</title>\n";
+            if (!styles.empty())
+                ret += "<style>\n" + styles.contentString() + "</style>\n";
+            ret += "</head><body>\n";
+            // Not display:none, gradients inside hidden <svg>s are not rendered by some browsers.
+            if (!definitions.empty())
+                ret += "<svg width=\"0\" height=\"0\" style=\"position:absolute\">\n"
+                       + definitions.toString() + elemEnd("svg");
+
+            std::size_t length = ret.size();
+            for (auto const &part : parts)
+                length += part.size();
+            ret.reserve(length + 32);
+            for (auto const &part : parts)
+                ret += part;
+            return ret + "</body></html>\n";
+        }
+
+        bool save() const {
+            std::ofstream ofs(file_name.c_str());
+            if (!ofs.good())
+                return false;
+
+            ofs << toString();
+            ofs.close();
+            return true;
+        }
+
+    private:
+        std::string file_name;
+        std::string title;
+        std::vector<Document> documents;
+    };
+
+    // Force directed graph layout after Fruchterman and Reingold.  Repulsion between all pairs
+    //  is approximated through a Barnes-Hut quadtree, so an iteration costs O(n log n).  The
+    //  forces on each node are summed independently, attraction over a compressed adjacency
+    //  list, so iterations run in parallel and give the same layout for any thread count.
+    class GraphLayout {
+    public:
+        GraphLayout(std::size_t node_count, std::uint64_t seed = 1) : positions(node_count) {
+            // Random start inside a square giving each node unit area, the ideal edge length.
+            double side = std::sqrt(double(node_count));
+            std::uint64_t state = seed * 0x9E3779B97F4A7C15ull + 1;
+            auto next = [&state]() {
+                state ^= state >> 12;
+                state ^= state << 25;
+                state ^= state >> 27;
+                return double((state * 0x2545F4914F6CDD1Dull) >> 11) / 9007199254740992.0;
+            };
+            for (auto &position : positions) {
+                double x = next() * side;
+                position = Point(x, next() * side);
+            }
+        }
+
+        GraphLayout &addEdge(std::uint32_t from, std::uint32_t to) {
+            if (from >= positions.size() || to >= positions.size())
+                throw std::out_of_range("svg::GraphLayout: unknown node");
+            edges.push_back(std::make_pair(from, to));
+            return *this;
+        }
+
+        std::size_t nodeCount() const { return positions.size(); }
+
+        std::size_t edgeCount() const { return edges.size(); }
+
+        // Runs the simulation.  Nodes move a fixed step along their net force, and the step
+        //  adapts to the total energy as in Hu's scheme: it shrinks whenever the energy rises
+        //  and grows again after five improving iterations.  Stops after `iterations`, or once
+        //  the lowest energy so far fell by less than `tolerance` relative over the last ten
+        //  iterations.
+        //  Smaller theta opens more quadtree cells and is more accurate.  An iteration takes
+        //  about 0.23 s per 100k nodes on one core.
+        void run(unsigned iterations = 100, unsigned threads = 0, double theta = 0.8, double tolerance = 0.01) {
+            std::size_t count = positions.size();
+            if (count < 2)
+                return;
+
+            buildAdjacency();
+            std::vector<Point> next(count);
+            std::vector<double> energies(count);
+            double step_length = std::sqrt(double(count)) / 10;
+            double energy = std::numeric_limits<double>::infinity();
+            double lowest = energy, history[10];
+            std::fill(history, history + 10, lowest);
+            unsigned progress = 0;
+            for (unsigned iteration = 0; iteration < iterations; ++iteration) {
+                buildTree();
+                parallelFor(count, [&](std::size_t begin, std::size_t end) {
+                    for (std::size_t n = begin; n < end; ++n) {
+                        std::uint32_t i = std::uint32_t(order[n]);
+                        next[i] = move(i, theta * theta, step_length, energies[i]);
+                    }
+                }, threads);
+                positions.swap(next);
+
+                double previous = energy;
+                energy = 0;
+                for (double e : energies)
+                    energy += e;
+                if (energy >= previous) {
+                    progress = 0;
+                    step_length *= 0.9;
+                }
+                else if (++progress >= 5) {
+                    progress = 0;
+                    step_length /= 0.9;
+                }
+
+                lowest = std::min(lowest, energy);
+                double &earlier = history[iteration % 10];
+                if (earlier - lowest < tolerance * earlier)
+                    break;
+                earlier = lowest;
+            }
+        }
+
+        std::vector<Point> const &getPositions() const { return positions; }
+
+        // Scale and center the layout into `box`, keeping its aspect ratio.
+        void fit(Rect const &box) {
+            Rect bounds;
+            if (!finiteBounds(positions, bounds))
+                return;
+
+            double scale = std::min(box.width() / std::max(bounds.width(), 1e-12),
+                                    box.height() / std::max(bounds.height(), 1e-12));
+            double x = box.minPt.x + (box.width() - bounds.width() * scale) / 2;
+            double y = box.minPt.y + (box.height() - bounds.height() * scale) / 2;
+            for (auto &position : positions)
+                position = Point(x + (position.x - bounds.minPt.x) * scale, y + (position.y - bounds.minPt.y) * scale);
+        }
+
+        CircleBatch nodes(double diameter, Fill const &fill = Fill(Color::Black), Stroke const &stroke = Stroke()) const {
+            CircleBatch batch(fill, stroke);
+            batch.reserve(positions.size());
+            for (auto const &position : positions)
+                batch.add(position, diameter);
+            return batch;
+        }
+
+        LineBatch edgeLines(Stroke const &stroke = Stroke(.5, Color::Silver)) const {
+            LineBatch batch(stroke);
+            batch.reserve(edges.size());
+            for (auto const &edge : edges)
+                batch.add(positions[edge.first], positions[edge.second]);
+            return batch;
+        }
+
+        // Fits the layout into `box` and appends the edges, then the nodes on top.
+        void draw(Document &document, Rect const &box, double node_diameter, Fill const &node_fill = Fill(Color::Black),
+                  Stroke const &edge_stroke = Stroke(.5, Color::Silver)) {
+            fit(box);
+            document << edgeLines(edge_stroke) << nodes(node_diameter, node_fill);
+        }
+
+    private:
+        // Quadtree cell, the four children of a cell are stored consecutively.  The center
+        //  holds the sum of member positions until the tree is complete.
+        struct Cell {
+            double x, y, size;
+            double center_x, center_y, mass;
+            std::int32_t first_child;
+            std::int32_t body;
+        };
+
+        static const int max_depth = 48;
+
+        std::vector<Point> positions;
+        std::vector<std::pair<std::uint32_t, std::uint32_t> > edges;
+        std::vector<std::uint32_t> neighbor_offsets, neighbors;
+        std::vector<Cell> cells;
+        std::vector<std::uint64_t> order;
+
+        void buildAdjacency() {
+            neighbor_offsets.assign(positions.size() + 1, 0);
+            for (auto const &edge : edges) {
+                ++neighbor_offsets[edge.first + 1];
+                ++neighbor_offsets[edge.second + 1];
+            }
+            for (std::size_t i = 1; i < neighbor_offsets.size(); ++i)
+                neighbor_offsets[i] += neighbor_offsets[i - 1];
+
+            neighbors.resize(edges.size() * 2);
+            std::vector<std::uint32_t> cursors(neighbor_offsets.begin(), neighbor_offsets.end() - 1);
+            for (auto const &edge : edges) {
+                neighbors[cursors[edge.first]++] = edge.second;
+                neighbors[cursors[edge.second]++] = edge.first;
+            }
+        }
+
+        void buildTree() {
+            Rect bounds;
+            finiteBounds(positions, bounds);
+            double size = std::max(bounds.width(), bounds.height()) * 1.000001 + 1e-9;
+
+            cells.clear();
+            cells.reserve(positions.size() * 2);
+            cells.push_back(Cell{bounds.minPt.x, bounds.minPt.y, size, 0, 0, 0, -1, -1});
+            for (std::size_t i = 0; i < positions.size(); ++i)
+                insert(std::uint32_t(i));
+            for (auto &cell : cells) {
+                if (cell.mass > 0) {
+                    cell.center_x /= cell.mass;
+                    cell.center_y /= cell.mass;
+                }
+            }
+
+            // Visit nodes in Z-order so consecutive nodes walk the same cells.
+            double scale = 65535 / size;
+            order.resize(positions.size());
+            for (std::size_t i = 0; i < positions.size(); ++i) {
+                auto key = [](std::uint64_t v) {
+                    v = (v | (v << 8)) & 0x00FF00FFull;
+                    v = (v | (v << 4)) & 0x0F0F0F0Full;
+                    v = (v | (v << 2)) & 0x33333333ull;
+                    return (v | (v << 1)) & 0x55555555ull;
+                };
+                // Clamped to the grid, NaN maps to 0.
+                double fx = (positions[i].x - bounds.minPt.x) * scale, fy = (positions[i].y - bounds.minPt.y) * scale;
+                std::uint64_t x = std::uint64_t(fx > 0 ? std::min(fx, 65535.0) : 0.0);
+                std::uint64_t y = std::uint64_t(fy > 0 ? std::min(fy, 65535.0) : 0.0);
+                order[i] = (key(x) | key(y) << 1) << 32 | i;
+            }
+            std::sort(order.begin(), order.end());
+        }
+
+        std::int32_t childOf(Cell const &cell, Point const &point) const {
+            double half = cell.size / 2;
+            return cell.first_child + (point.x >= cell.x + half) + 2 * (point.y >= cell.y + half);
+        }
+
+        void insert(std::uint32_t body) {
+            Point const &point = positions[body];
+            std::int32_t index = 0;
+            for (int depth = 0;; ++depth) {
+                Cell &cell = cells[index];
+                if (cell.first_child < 0 && (cell.mass == 0 || depth == max_depth)) {
+                    // Empty leaf, or coincident nodes sharing the deepest cell.
+                    if (cell.mass == 0)
+                        cell.body = std::int32_t(body);
+                    cell.center_x += point.x;
+                    cell.center_y += point.y;
+                    cell.mass += 1;
+                    return;
+                }
+
+                if (cell.first_child < 0) {
+                    // Split the leaf and move its node one level down.
+                    double half = cell.size / 2;
+                    std::int32_t resident = cell.body;
+                    Cell parent = cell;
+                    parent.first_child = std::int32_t(cells.size());
+                    parent.body = -1;
+                    for (int quadrant = 0; quadrant < 4; ++quadrant)
+                        cells.push_back(Cell{parent.x + half * (quadrant & 1), parent.y + half * (quadrant >> 1),
+                                             half, 0, 0, 0, -1, -1});
+                    Cell &child = cells[childOf(parent, positions[resident])];
+                    child.center_x = parent.center_x;
+                    child.center_y = parent.center_y;
+                    child.mass = parent.mass;
+                    child.body = resident;
+                    cells[index] = parent;
+                }
+
+                Cell &parent = cells[index];
+                parent.center_x += point.x;
+                parent.center_y += point.y;
+                parent.mass += 1;
+                index = childOf(parent, point);
+            }
+        }
+
+        // New position of node i: repulsion k^2 / d from every other node and attraction
+        //  d^2 / k along edges, with k = 1.  Stores the squared net force in `energy`.
+        Point move(std::uint32_t i, double theta2, double step_length, double &energy) const {
+            Point const &point = positions[i];
+            double force_x = 0, force_y = 0;
+
+            std::int32_t stack[4 * max_depth + 4];
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0) {
+                Cell const &cell = cells[stack[--top]];
+                if (cell.mass == 0)
+                    continue;
+
+                double dx = point.x - cell.center_x;
+                double dy = point.y - cell.center_y;
+                double d2 = dx * dx + dy * dy;
+                bool inside = point.x >= cell.x && point.x < cell.x + cell.size
+                              && point.y >= cell.y && point.y < cell.y + cell.size;
+                if (cell.first_child >= 0 && (inside || cell.size * cell.size >= theta2 * d2)) {
+                    for (int quadrant = 0; quadrant < 4; ++quadrant)
+                        stack[top++] = cell.first_child + quadrant;
+                    continue;
+                }
+                if (cell.body == std::int32_t(i) || d2 < 1e-18)
+                    continue;
+
+                force_x += dx * cell.mass / d2;
+                force_y += dy * cell.mass / d2;
+            }
+
+            for (std::uint32_t n = neighbor_offsets[i]; n < neighbor_offsets[i + 1]; ++n) {
+                Point const &other = positions[neighbors[n]];
+                double dx = point.x - other.x, dy = point.y - other.y;
+                double distance = std::sqrt(dx * dx + dy * dy);
+                force_x -= dx * distance;
+                force_y -= dy * distance;
+            }
+
+            energy = force_x * force_x + force_y * force_y;
+            if (!(energy > 0))
+                return point;
+
+            double scale = step_length / std::sqrt(energy);
+            return Point(point.x + force_x * scale, point.y + force_y * scale);
+        }
+    };
+
+    // Squarified treemap (Bruls, Huizing and van Wijk) of a hierarchy given as a flat array of
+    //  parent indices, negative for roots.  The area of a node is proportional to its weight
+    //  plus the weights of its descendants.  Layout is linear in the number of nodes apart from
+    //  sorting each node's children, and independent subtrees are laid out in parallel.
+    //  Nodes covering less than a pixel are culled together with their subtrees.
+    class Treemap {
+    public:
+        Treemap(std::vector<std::int32_t> const &parents, std::vector<double> const &weights)
+                : totals(parents.size()) {
+            if (weights.size() != parents.size())
+                throw std::out_of_range("svg::Treemap: weights do not match parents");
+
+            // Children in compressed rows, row `count` holds the roots.
+            std::size_t count = parents.size();
+            child_offsets.assign(count + 2, 0);
+            for (std::size_t i = 0; i < count; ++i) {
+                if (parents[i] >= 0 && std::size_t(parents[i]) >= count)
+                    throw std::out_of_range("svg::Treemap: unknown parent");
+                ++child_offsets[(parents[i] < 0 ? count : std::size_t(parents[i])) + 1];
+            }
+            for (std::size_t i = 1; i < child_offsets.size(); ++i)
+                child_offsets[i] += child_offsets[i - 1];
+            children.resize(count);
+            std::vector<std::uint32_t> cursors(child_offsets.begin(), child_offsets.end() - 1);
+            for (std::size_t i = 0; i < count; ++i)
+                children[cursors[parents[i] < 0 ? count : std::size_t(parents[i])]++] = std::uint32_t(i);
+
+            // Breadth first order from the roots, nodes on cycles are never reached.
+            std::vector<std::uint32_t> order;
+            order.reserve(count);
+            order.insert(order.end(), children.begin() + child_offsets[count], children.end());
+            for (std::size_t i = 0; i < order.size(); ++i)
+                order.insert(order.end(), children.begin() + child_offsets[order[i]],
+                             children.begin() + child_offsets[order[i] + 1]);
+
+            for (std::size_t i = order.size(); i-- > 0;) {
+                std::uint32_t node = order[i];
+                double weight = weights[node] > 0 && weights[node] < std::numeric_limits<double>::infinity()
+                                ? weights[node] : 0;
+                totals[node] += weight;
+                if (parents[node] >= 0)
+                    totals[parents[node]] += totals[node];
+            }
+
+            auto heavier = [this](std::uint32_t a, std::uint32_t b) { return totals[a] > totals[b]; };
+            parallelFor(count + 1, [&](std::size_t begin, std::size_t end) {
+                for (std::size_t i = begin; i < end; ++i)
+                    std::sort(children.begin() + child_offsets[i], children.begin() + child_offsets[i + 1], heavier);
+            });
+        }
+
+        // Lays out the roots inside `box`.  `layout` gives the output scale used for culling.
+        void layout(Rect const &box, Layout const &layout = Layout(), unsigned threads = 0) {
+            std::size_t count = totals.size();
+            double nan = std::numeric_limits<double>::quiet_NaN();
+            xs.assign(count + 1, nan);
+            ys.assign(count + 1, nan);
+            widths.assign(count + 1, nan);
+            heights.assign(count + 1, nan);
+            open.assign(count + 1, 0);
+            xs[count] = box.minPt.x;
+            ys[count] = box.minPt.y;
+            widths[count] = box.width();
+            heights[count] = box.height();
+
+            double root_total = 0;
+            for (std::uint32_t n = child_offsets[count]; n < child_offsets[count + 1]; ++n)
+                root_total += totals[children[n]];
+            double min_area = 1 / (translateScale(1, layout) * translateScale(1, layout));
+
+            // Top levels run serially until there are enough subtrees to share out.
+            std::vector<std::uint32_t> frontier(1, std::uint32_t(count)), next;
+            while (!frontier.empty() && frontier.size() < 256) {
+                next.clear();
+                for (std::uint32_t node : frontier)
+                    squarify(node, node == count ? root_total : totals[node], min_area, next);
+                frontier.swap(next);
+            }
+
+            parallelFor(frontier.size(), [&](std::size_t begin, std::size_t end) {
+                std::vector<std::uint32_t> stack(frontier.begin() + begin, frontier.begin() + end);
+                while (!stack.empty()) {
+                    std::uint32_t node = stack.back();
+                    stack.pop_back();
+                    squarify(node, totals[node], min_area, stack);
+                }
+            }, threads);
+        }
+
+        std::size_t size() const { return totals.size(); }
+
+        // Weight of the node and its descendants.
+        double total(std::size_t node) const { return totals[node]; }
+
+        // False for nodes that were culled or not laid out.
+        bool visible(std::size_t node) const { return node < xs.size() && widths[node] == widths[node]; }
+
+        Rect bounds(std::size_t node) const { return Rect(Point(xs[node], ys[node]), widths[node], heights[node]); }
+
+        // Visible nodes without visible children, i.e. what is seen from above.
+        RectangleBatch rectangles(Fill const &fill = Fill(Color::Silver), Stroke const &stroke = Stroke(.5, Color::White)) const {
+            RectangleBatch batch(fill, stroke);
+            addRectangles(batch, [](std::size_t) { return std::uint32_t(0); });
+            return batch;
+        }
+
+        // As above into an existing batch, with the palette style of each node given by style(node).
+        template<typename F>
+        void addRectangles(RectangleBatch &batch, F const &style) const {
+            for (std::size_t i = 0; i < totals.size(); ++i)
+                if (visible(i) && !open[i])
+                    batch.add(Point(xs[i], ys[i]), widths[i], heights[i], style(i));
+        }
+
+    private:
+        std::vector<double> totals;
+        std::vector<std::uint32_t> child_offsets, children;
+        std::vector<double> xs, ys, widths, heights;
+        std::vector<char> open;
+
+        // Places the children of a laid out node in rows along the shorter side, extending a row
+        //  while that improves its worst aspect ratio.  Children covering at least `min_area`
+        //  are appended to `visible`.
+        void squarify(std::uint32_t node, double total, double min_area, std::vector<std::uint32_t> &visible) {
+            double x = xs[node], y = ys[node], width = widths[node], height = heights[node];
+            if (!(total > 0) || !(width > 0) || !(height > 0))
+                return;
+
+            double scale = width * height / total;
+            std::uint32_t begin = child_offsets[node], end = child_offsets[node + 1];
+            while (begin < end && totals[children[end - 1]] <= 0)
+                --end;
+
+            while (begin < end) {
+                double side = std::min(width, height);
+                double side2 = side * side;
+                double largest = totals[children[begin]] * scale;
+                double sum = largest, worst = std::max(side2 / largest, largest / side2);
+                std::uint32_t row_end = begin + 1;
+                for (; row_end < end; ++row_end) {
+                    double area = totals[children[row_end]] * scale;
+                    double next_sum = sum + area;
+                    double next_worst = std::max(side2 * largest / (next_sum * next_sum),
+                                                 next_sum * next_sum / (side2 * area));
+                    if (next_worst > worst)
+                        break;
+                    sum = next_sum;
+                    worst = next_worst;
+                }
+
+                // The row takes a strip of thickness sum / side across the shorter side.
+                double thickness = sum / side, offset = 0;
+                for (std::uint32_t n = begin; n < row_end; ++n) {
+                    std::uint32_t child = children[n];
+                    double length = n + 1 == row_end ? side - offset : totals[child] * scale / thickness;
+                    if (width >= height) {
+                        xs[child] = x;
+                        ys[child] = y + offset;
+                        widths[child] = thickness;
+                        heights[child] = length;
+                    }
+                    else {
+                        xs[child] = x + offset;
+                        ys[child] = y;
+                        widths[child] = length;
+                        heights[child] = thickness;
+                    }
+                    offset += length;
+
+                    if (thickness * length >= min_area) {
+                        open[node] = 1;
+                        visible.push_back(child);
+                    }
+                    else
+                        widths[child] = std::numeric_limits<double>::quiet_NaN();
+                }
+
+                if (width >= height) {
+                    x += thickness;
+                    width -= thickness;
+                }
+                else {
+                    y += thickness;
+                    height -= thickness;
+                }
+                begin = row_end;
+            }
+        }
+    };
+
+    // Tidy drawing of a hierarchy given as a flat array of parent indices, negative for roots,
+    //  with Walker's algorithm in the linear time form of Buchheim, Junger and Leipert.  Both
+    //  walks are iterative, so degenerate trees of any depth are fine.  Children keep their
+    //  index order from left to right and roots are laid out as siblings.
+    class TreeLayout {
+    public:
+        enum Connector {
+            Straight, Elbow
+        };
+
+        TreeLayout(std::vector<std::int32_t> const &parents) : parents(parents.size()) {
+            std::size_t count = parents.size();
+            child_offsets.assign(count + 2, 0);
+            for (std::size_t i = 0; i < count; ++i) {
+                if (parents[i] >= 0 && std::size_t(parents[i]) >= count)
+                    throw std::out_of_range("svg::TreeLayout: unknown parent");
+                this->parents[i] = parents[i] < 0 ? std::uint32_t(count) : std::uint32_t(parents[i]);
+                ++child_offsets[this->parents[i] + 1];
+            }
+            for (std::size_t i = 1; i < child_offsets.size(); ++i)
+                child_offsets[i] += child_offsets[i - 1];
+            children.resize(count);
+            std::vector<std::uint32_t> cursors(child_offsets.begin(), child_offsets.end() - 1);
+            for (std::size_t i = 0; i < count; ++i)
+                children[cursors[this->parents[i]]++] = std::uint32_t(i);
+            layout();
+        }
+
+        // Places nodes `sibling_distance` apart within a level and `level_distance` apart
+        //  between levels, roots on top with the leftmost node at `origin`.  Nodes on parent
+        //  cycles are not reachable from any root and are not placed.
+        void layout(double sibling_distance = 1, double level_distance = 1, Point const &origin = Point(0, 0)) {
+            std::size_t count = parents.size();
+            firstWalk();
+
+            // Second walk in breadth first order, accumulating the modifiers of the ancestors.
+            order.clear();
+            order.reserve(count);
+            std::vector<double> modifier_sums(count + 1, 0);
+            double nan = std::numeric_limits<double>::quiet_NaN();
+            xs.assign(count, nan);
+            ys.assign(count, nan);
+            order.insert(order.end(), children.begin() + child_offsets[count], children.end());
+            level_starts.assign(1, 0);
+            std::size_t level_end = order.size();
+            double min_x = HUGE_VAL;
+            for (std::size_t i = 0; i < order.size(); ++i) {
+                if (i == level_end) {
+                    level_starts.push_back(i);
+                    level_end = order.size();
+                }
+                std::uint32_t node = order[i];
+                std::uint32_t parent = parents[node];
+                modifier_sums[node] = modifier_sums[parent] + (parent == count ? 0 : modifiers[parent]);
+                xs[node] = prelims[node] + modifier_sums[node];
+                ys[node] = origin.y + (level_starts.size() - 1) * level_distance;
+                min_x = std::min(min_x, xs[node]);
+                order.insert(order.end(), children.begin() + child_offsets[node], children.begin() + child_offsets[node + 1]);
+            }
+            level_starts.push_back(order.size());
+            for (auto node : order)
+                xs[node] = origin.x + (xs[node] - min_x) * sibling_distance;
+        }
+
+        std::size_t size() const { return parents.size(); }
+
+        // NaN for nodes that were not placed.
+        Point position(std::size_t node) const { return Point(xs[node], ys[node]); }
+
+        Rect bounds() const {
+            Rect ret;
+            finiteBounds(positions(), ret);
+            return ret;
+        }
+
+        CircleBatch nodes(double diameter, Fill const &fill = Fill(Color::Black), Stroke const &stroke = Stroke()) const {
+            CircleBatch batch(fill, stroke);
+            batch.reserve(order.size());
+            for (auto node : order)
+                batch.add(position(node), diameter);
+            return batch;
+        }
+
+        // Parent to child connectors in one path.  Elbow connectors share a vertical stem
+        //  and a horizontal bar per parent, halfway between the levels.
+        LineBatch connectors(Stroke const &stroke = Stroke(.5, Color::Silver), Connector connector = Straight) const {
+            LineBatch batch(stroke);
+            batch.reserve(order.size() * (connector == Elbow ? 2 : 1));
+            for (auto node : order) {
+                std::uint32_t begin = child_offsets[node], end = child_offsets[node + 1];
+                if (begin == end)
+                    continue;
+
+                Point parent = position(node);
+                if (connector == Straight) {
+                    for (std::uint32_t n = begin; n < end; ++n)
+                        batch.add(parent, position(children[n]));
+                    continue;
+                }
+
+                double middle = (parent.y + ys[children[begin]]) / 2;
+                batch.add(parent, Point(parent.x, middle));
+                if (end - begin > 1 || xs[children[begin]] != parent.x)
+                    batch.add(Point(std::min(parent.x, xs[children[begin]]), middle),
+                              Point(std::max(parent.x, xs[children[end - 1]]), middle));
+                for (std::uint32_t n = begin; n < end; ++n)
+                    batch.add(Point(xs[children[n]], middle), position(children[n]));
+            }
+            return batch;
+        }
+
+        // Labels centered on their nodes, only where they do not overlap the labels of the
+        //  neighbors on the same level.  Widths are estimated at 0.6 em per character, and no
+        //  labels are written when the font would be under a pixel at the output scale of
+        //  `layout`.
+        TextBatch labels(std::vector<std::string> const &texts, Font const &font = Font(),
+                         Fill const &fill = Fill(Color::Black), Layout const &layout = Layout()) const {
+            TextBatch batch(fill, font, TextBatch::Middle);
+            double size = font.fontSize();
+            if (translateScale(size, layout) < 1)
+                return batch;
+
+            auto width = [&](std::uint32_t node) {
+                return node < texts.size() ? 0.6 * size * texts[node].size() : 0.0;
+            };
+            for (std::size_t level = 0; level + 1 < level_starts.size(); ++level) {
+                std::size_t begin = level_starts[level], end = level_starts[level + 1];
+                for (std::size_t i = begin; i < end; ++i) {
+                    std::uint32_t node = order[i];
+                    double own = width(node);
+                    if (own == 0)
+                        continue;
+
+                    bool fits = true;
+                    if (i > begin)
+                        fits = (own + width(order[i - 1])) / 2 <= xs[node] - xs[order[i - 1]];
+                    if (i + 1 < end)
+                        fits = fits && (own + width(order[i + 1])) / 2 <= xs[order[i + 1]] - xs[node];
+                    if (fits)
+                        batch.add(Point(xs[node], ys[node] + 0.35 * size), texts[node]);
+                }
+            }
+            return batch;
+        }
+
+    private:
+        std::vector<std::uint32_t> parents;
+        std::vector<std::uint32_t> child_offsets, children;
+        std::vector<double> prelims, modifiers, shifts, changes;
+        std::vector<std::uint32_t> contour_threads, ancestors, slots;
+        std::vector<std::uint32_t> order;
+        std::vector<std::size_t> level_starts;
+        std::vector<double> xs, ys;
+
+        static const std::uint32_t none = 0xFFFFFFFFu;
+
+        std::vector<Point> positions() const {
+            std::vector<Point> ret;
+            ret.reserve(order.size());
+            for (auto node : order)
+                ret.push_back(position(node));
+            return ret;
+        }
+
+        bool isLeaf(std::uint32_t node) const { return child_offsets[node] == child_offsets[node + 1]; }
+
+        std::uint32_t nextLeft(std::uint32_t node) const {
+            return isLeaf(node) ? contour_threads[node] : children[child_offsets[node]];
+        }
+
+        std::uint32_t nextRight(std::uint32_t node) const {
+            return isLeaf(node) ? contour_threads[node] : children[child_offsets[node + 1] - 1];
+        }
+
+        // Post-order walk computing preliminary positions and modifiers.  The slot of a node in
+        //  `children` gives its sibling number in O(1).
+        void firstWalk() {
+            std::size_t count = parents.size();
+            prelims.assign(count + 1, 0);
+            modifiers.assign(count + 1, 0);
+            shifts.assign(count + 1, 0);
+            changes.assign(count + 1, 0);
+            contour_threads.assign(count + 1, std::uint32_t(none));
+            ancestors.resize(count + 1);
+            for (std::size_t i = 0; i <= count; ++i)
+                ancestors[i] = std::uint32_t(i);
+            slots.resize(count + 1);
+            for (std::size_t n = 0; n < count; ++n)
+                slots[children[n]] = std::uint32_t(n);
+            slots[count] = 0;
+
+            std::vector<std::uint32_t> default_ancestors(count + 1);
+            std::vector<std::pair<std::uint32_t, std::uint32_t> > stack(1, std::make_pair(std::uint32_t(count), child_offsets[count]));
+            while (!stack.empty()) {
+                std::uint32_t node = stack.back().first;
+                std::uint32_t next = stack.back().second;
+                if (next < child_offsets[node + 1]) {
+                    ++stack.back().second;
+                    if (next == child_offsets[node])
+                        default_ancestors[node] = children[next];
+                    stack.push_back(std::make_pair(children[next], child_offsets[children[next]]));
+                    continue;
+                }
+                stack.pop_back();
+                if (node == count)
+                    break;
+
+                std::uint32_t parent = parents[node];
+                bool first = slots[node] == child_offsets[parent];
+                std::uint32_t left = first ? none : children[slots[node] - 1];
+                if (!isLeaf(node)) {
+                    executeShifts(node);
+                    double midpoint = (prelims[children[child_offsets[node]]]
+                                       + prelims[children[child_offsets[node + 1] - 1]]) / 2;
+                    if (first)
+                        prelims[node] = midpoint;
+                    else {
+                        prelims[node] = prelims[left] + 1;
+                        modifiers[node] = prelims[node] - midpoint;
+                    }
+                }
+                else
+                    prelims[node] = first ? 0 : prelims[left] + 1;
+                if (!first)
+                    default_ancestors[parent] = apportion(node, left, default_ancestors[parent]);
+            }
+            if (!isLeaf(std::uint32_t(count)))
+                executeShifts(std::uint32_t(count));
+        }
+
+        std::uint32_t apportion(std::uint32_t node, std::uint32_t left, std::uint32_t default_ancestor) {
+            std::uint32_t inner_right = node, outer_right = node;
+            std::uint32_t inner_left = left, outer_left = children[child_offsets[parents[node]]];
+            double inner_right_sum = modifiers[inner_right], outer_right_sum = modifiers[outer_right];
+            double inner_left_sum = modifiers[inner_left], outer_left_sum = modifiers[outer_left];
+            while (nextRight(inner_left) != none && nextLeft(inner_right) != none) {
+                inner_left = nextRight(inner_left);
+                inner_right = nextLeft(inner_right);
+                outer_left = nextLeft(outer_left);
+                outer_right = nextRight(outer_right);
+                ancestors[outer_right] = node;
+                double shift = prelims[inner_left] + inner_left_sum - prelims[inner_right] - inner_right_sum + 1;
+                if (shift > 0) {
+                    std::uint32_t ancestor = parents[ancestors[inner_left]] == parents[node]
+                                             ? ancestors[inner_left] : default_ancestor;
+                    moveSubtree(ancestor, node, shift);
+                    inner_right_sum += shift;
+                    outer_right_sum += shift;
+                }
+                inner_left_sum += modifiers[inner_left];
+                inner_right_sum += modifiers[inner_right];
+                outer_left_sum += modifiers[outer_left];
+                outer_right_sum += modifiers[outer_right];
+            }
+            if (nextRight(inner_left) != none && nextRight(outer_right) == none) {
+                contour_threads[outer_right] = nextRight(inner_left);
+                modifiers[outer_right] += inner_left_sum - outer_right_sum;
+            }
+            if (nextLeft(inner_right) != none && nextLeft(outer_left) == none) {
+                contour_threads[outer_left] = nextLeft(inner_right);
+                modifiers[outer_left] += inner_right_sum - outer_left_sum;
+                default_ancestor = node;
+            }
+            return default_ancestor;
+        }
+
+        void moveSubtree(std::uint32_t from, std::uint32_t to, double shift) {
+            double subtrees = double(slots[to]) - double(slots[from]);
+            changes[to] -= shift / subtrees;
+            shifts[to] += shift;
+            changes[from] += shift / subtrees;
+            prelims[to] += shift;
+            modifiers[to] += shift;
+        }
+
+        void executeShifts(std::uint32_t node) {
+            double shift = 0, change = 0;
+            for (std::uint32_t n = child_offsets[node + 1]; n-- > child_offsets[node];) {
+                std::uint32_t child = children[n];
+                prelims[child] += shift;
+                modifiers[child] += shift;
+                change += changes[child];
+                shift += shifts[child] + change;
+            }
+        }
 
-        std::string body_nodes_str;
     };
 }
 
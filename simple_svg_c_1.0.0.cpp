@@ -0,0 +1,194 @@
+/*******************************************************************************
+*  The "New BSD License" : http://www.opensource.org/licenses/bsd-license.php  *
+********************************************************************************
+
+Copyright (c) 2010, Mark Turney
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+#include "simple_svg_c_1.0.0.h"
+#include "simple_svg_1.0.0.hpp"
+
+#include <new>
+
+using namespace svg;
+
+struct svg_document {
+    svg_document(char const *file_name) : document(file_name) {}
+
+    Document document;
+};
+
+struct svg_shape {
+    std::unique_ptr<Shape> shape;
+};
+
+namespace {
+    Color toColor(long rgb) {
+        if (rgb < 0)
+            return Color::Transparent;
+        return Color(int((rgb >> 16) & 0xff), int((rgb >> 8) & 0xff), int(rgb & 0xff));
+    }
+
+    Fill toFill(svg_style const *style) {
+        return style ? Fill(toColor(style->fill_rgb)) : Fill();
+    }
+
+    Stroke toStroke(svg_style const *style) {
+        return style ? Stroke(style->stroke_width, toColor(style->stroke_rgb)) : Stroke();
+    }
+
+    std::vector<Point> toPoints(double const *x, double const *y, size_t n) {
+        std::vector<Point> points;
+        points.reserve(n);
+        for (size_t i = 0; i < n; ++i)
+            points.push_back(Point(x[i], y[i]));
+        return points;
+    }
+
+    // Exceptions must not cross the C boundary.
+    template<typename F>
+    int guarded(F const &fn) {
+        try {
+            fn();
+            return SVG_OK;
+        } catch (std::bad_alloc const &) {
+            return SVG_ERROR_OUT_OF_MEMORY;
+        } catch (...) {
+            return SVG_ERROR_INVALID_ARGUMENT;
+        }
+    }
+}
+
+extern "C" {
+
+svg_document *svg_document_create(char const *file_name) {
+    if (!file_name)
+        return nullptr;
+    return new(std::nothrow) svg_document(file_name);
+}
+
+void svg_document_destroy(svg_document *document) {
+    delete document;
+}
+
+int svg_document_save(svg_document const *document) {
+    if (!document)
+        return SVG_ERROR_INVALID_ARGUMENT;
+
+    bool saved = false;
+    int status = guarded([&]() { saved = document->document.save(); });
+    if (status != SVG_OK)
+        return status;
+    return saved ? SVG_OK : SVG_ERROR_IO;
+}
+
+size_t svg_document_to_string(svg_document const *document, char *buffer, size_t size) {
+    if (!document)
+        return 0;
+
+    std::string str;
+    if (guarded([&]() { str = document->document.toString(); }) != SVG_OK)
+        return 0;
+
+    if (buffer && size) {
+        size_t length = std::min(size - 1, str.size());
+        std::memcpy(buffer, str.data(), length);
+        buffer[length] = '\0';
+    }
+    return str.size();
+}
+
+svg_shape *svg_polyline_from_xy(double const *x, double const *y, size_t n, svg_style const *style) {
+    if ((!x || !y) && n)
+        return nullptr;
+
+    svg_shape *ret = new(std::nothrow) svg_shape;
+    if (!ret)
+        return nullptr;
+    if (guarded([&]() { ret->shape.reset(new Polyline(toPoints(x, y, n), toFill(style), toStroke(style))); }) != SVG_OK) {
+        delete ret;
+        return nullptr;
+    }
+    return ret;
+}
+
+svg_shape *svg_polygon_from_xy(double const *x, double const *y, size_t n, svg_style const *style) {
+    if ((!x || !y) && n)
+        return nullptr;
+
+    svg_shape *ret = new(std::nothrow) svg_shape;
+    if (!ret)
+        return nullptr;
+    int status = guarded([&]() {
+        std::unique_ptr<Polygon> polygon(new Polygon(toFill(style), toStroke(style)));
+        for (size_t i = 0; i < n; ++i)
+            *polygon << Point(x[i], y[i]);
+        ret->shape = std::move(polygon);
+    });
+    if (status != SVG_OK) {
+        delete ret;
+        return nullptr;
+    }
+    return ret;
+}
+
+void svg_shape_destroy(svg_shape *shape) {
+    delete shape;
+}
+
+int svg_document_add(svg_document *document, svg_shape const *shape) {
+    if (!document || !shape || !shape->shape)
+        return SVG_ERROR_INVALID_ARGUMENT;
+    return guarded([&]() { document->document << *shape->shape; });
+}
+
+int svg_document_add_circles(svg_document *document, double const *cx, double const *cy,
+                             double const *diameter, size_t n, svg_style const *style) {
+    if (!document || ((!cx || !cy || !diameter) && n))
+        return SVG_ERROR_INVALID_ARGUMENT;
+
+    return guarded([&]() {
+        CircleBatch batch(toFill(style), toStroke(style));
+        batch.add(cx, cy, diameter, n);
+        document->document << batch;
+    });
+}
+
+int svg_document_add_rects(svg_document *document, double const *x, double const *y,
+                           double const *width, double const *height, size_t n,
+                           svg_style const *style) {
+    if (!document || ((!x || !y || !width || !height) && n))
+        return SVG_ERROR_INVALID_ARGUMENT;
+
+    return guarded([&]() {
+        RectangleBatch batch(toFill(style), toStroke(style));
+        batch.add(x, y, width, height, n);
+        document->document << batch;
+    });
+}
+
+}
@@ -0,0 +1,101 @@
+/*******************************************************************************
+*  The "New BSD License" : http://www.opensource.org/licenses/bsd-license.php  *
+********************************************************************************
+
+Copyright (c) 2010, Mark Turney
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+/* C interface to Simple SVG for FFI callers.  Documents and shapes are opaque handles, and
+ *  geometry is passed as whole arrays so a foreign caller crosses the boundary once per batch
+ *  instead of once per point. */
+
+#ifndef SIMPLE_SVG_C_H
+#define SIMPLE_SVG_C_H
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#  if defined(SIMPLE_SVG_C_EXPORTS)
+#    define SVG_C_API __declspec(dllexport)
+#  else
+#    define SVG_C_API __declspec(dllimport)
+#  endif
+#else
+#  define SVG_C_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Status codes returned by the functions that do not return a handle. */
+enum {
+    SVG_OK = 0,
+    SVG_ERROR_INVALID_ARGUMENT = -1,
+    SVG_ERROR_OUT_OF_MEMORY = -2,
+    SVG_ERROR_IO = -3
+};
+
+typedef struct svg_document svg_document;
+typedef struct svg_shape svg_shape;
+
+/* Colors are 0xRRGGBB, a negative color is transparent.  A negative stroke width disables
+ *  the stroke.  A null style pointer means transparent fill and no stroke. */
+typedef struct svg_style {
+    long fill_rgb;
+    long stroke_rgb;
+    double stroke_width;
+} svg_style;
+
+SVG_C_API svg_document *svg_document_create(char const *file_name);
+SVG_C_API void svg_document_destroy(svg_document *document);
+SVG_C_API int svg_document_save(svg_document const *document);
+
+/* Copy the serialized document into buffer, truncating to size - 1 characters plus the
+ *  terminator.  Returns the full length, so a call with size 0 queries the required size. */
+SVG_C_API size_t svg_document_to_string(svg_document const *document, char *buffer, size_t size);
+
+/* Shapes built from arrays of n coordinates.  Returns null on invalid arguments. */
+SVG_C_API svg_shape *svg_polyline_from_xy(double const *x, double const *y, size_t n,
+                                          svg_style const *style);
+SVG_C_API svg_shape *svg_polygon_from_xy(double const *x, double const *y, size_t n,
+                                         svg_style const *style);
+SVG_C_API void svg_shape_destroy(svg_shape *shape);
+SVG_C_API int svg_document_add(svg_document *document, svg_shape const *shape);
+
+/* Append n circles or rectangles sharing one style. */
+SVG_C_API int svg_document_add_circles(svg_document *document, double const *cx, double const *cy,
+                                       double const *diameter, size_t n, svg_style const *style);
+SVG_C_API int svg_document_add_rects(svg_document *document, double const *x, double const *y,
+                                     double const *width, double const *height, size_t n,
+                                     svg_style const *style);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
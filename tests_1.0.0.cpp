@@ -0,0 +1,1049 @@
+
+/*******************************************************************************
+*  The "New BSD License" : http://www.opensource.org/licenses/bsd-license.php  *
+********************************************************************************
+
+Copyright (c) 2010, Mark Turney
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+#include "simple_svg_1.0.0.hpp"
+#include "simple_svg_c_1.0.0.h"
+
+#include <map>
+#include <random>
+
+using namespace svg;
+
+// Behavioural checks that the demo output does not cover.  Every check prints a line, the
+//  exit status is 1 when any check failed.  Registered with CTest as "unit".
+
+namespace {
+    int failures = 0;
+
+    void check(bool passed, std::string const &name, double value) {
+        std::cout << (passed ? "ok     " : "FAILED ") << name << " (" << value << ")\n";
+        failures += !passed;
+    }
+
+    std::size_t occurrences(std::string const &text, std::string const &needle) {
+        std::size_t count = 0;
+        for (std::size_t at = text.find(needle); at != std::string::npos; at = text.find(needle, at + 1))
+            ++count;
+        return count;
+    }
+
+    // Equal gradients used by several shapes are written once and referenced by one id, and
+    //  definitions nested in a pattern come before the pattern.
+    void testDefinitionDeduplication() {
+        LinearGradient first, second;
+        first << Stop(0, Color::Red) << Stop(1, Color::Blue);
+        second << Stop(0, Color::Red) << Stop(1, Color::Blue);
+        RadialGradient other;
+        other << Stop(0, Color::Green);
+
+        Document document("unused.svg");
+        document << Circle(Point(1, 1), 2, Fill(first)) << Rectangle(Point(0, 0), 1, 1, Fill(second))
+                 << Circle(Point(2, 2), 2, Fill(other));
+        std::string svg = document.toString();
+        check(occurrences(svg, "<linearGradient") == 1, "equal gradients share one definition",
+              double(occurrences(svg, "<linearGradient")));
+        check(occurrences(svg, "<radialGradient") == 1, "different gradients get their own definition",
+              double(occurrences(svg, "<radialGradient")));
+
+        auto paintId = [](Fill const &fill) {
+            std::string attribute = fill.toString();
+            std::size_t begin = attribute.find('#') + 1;
+            return attribute.substr(begin, attribute.find(')') - begin);
+        };
+        std::string id = paintId(Fill(first));
+        check(id == paintId(Fill(second)) && occurrences(svg, "url(#" + id + ")") == 2
+              && occurrences(svg, "id=\"" + id + "\"") == 1, "shapes reference the shared id",
+              double(occurrences(svg, "url(#" + id + ")")));
+
+        Pattern pattern(Dimensions(4, 4));
+        pattern << Circle(Point(2, 2), 2, Fill(other));
+        Document patterned("unused.svg");
+        patterned << Rectangle(Point(0, 0), 8, 8, Fill(pattern));
+        svg = patterned.toString();
+        check(svg.find("<radialGradient") < svg.find("<pattern"), "pattern dependencies come first",
+              double(svg.find("<radialGradient")));
+    }
+
+    std::string readFile(std::string const &file_name) {
+        std::ifstream ifs(file_name.c_str(), std::ios::binary);
+        std::stringstream ss;
+        ss << ifs.rdbuf();
+        return ifs.good() || ifs.eof() ? ss.str() : std::string();
+    }
+
+    bool fileExists(std::string const &file_name) {
+        return std::ifstream(file_name.c_str()).good();
+    }
+
+    // Frames share the static prefix and differ in their own shapes.  Patterns without exactly
+    //  one integer conversion would give every frame the same name, or be undefined, and are
+    //  rejected before anything is written.
+    void testAnimationFrames() {
+        Animation animation;
+        animation << Rectangle(Point(0, 0), 10, 10, Fill(Color::Silver));
+        animation.addFrames(3, [](Frame &frame, std::size_t i) {
+            frame << Circle(Point(double(i), 5), 2, Fill(Color::Red));
+        });
+
+        check(animation.saveFrames("unit_frame_%03d.svg", 2), "frames saved with a valid pattern", 1);
+        std::string frames[3];
+        for (int i = 0; i < 3; ++i) {
+            char name[32];
+            std::snprintf(name, sizeof(name), "unit_frame_%03d.svg", i);
+            frames[i] = readFile(name);
+            std::remove(name);
+        }
+        check(!frames[0].empty() && frames[0] != frames[1] && frames[1] != frames[2]
+              && frames[2].find("cx=\"2\"") != std::string::npos
+              && frames[0].substr(0, frames[0].find("<circle")) == frames[2].substr(0, frames[2].find("<circle")),
+              "frames share the prefix and differ in their shapes", double(frames[0].size()));
+
+        char const *invalid[] = {"unit_frame.svg", "unit_frame_%s.svg", "unit_frame_%d_%d.svg", "unit_frame_%f.svg",
+                                 "unit_frame_%*d.svg", "unit_frame_%ld.svg", "unit_frame_%"};
+        std::size_t accepted = 0;
+        for (char const *pattern : invalid) {
+            accepted += animation.saveFrames(pattern);
+            accepted += fileExists("unit_frame.svg");
+        }
+        check(accepted == 0, "frame patterns without one integer conversion rejected", double(accepted));
+        check(animation.saveFrames("unit_%%_%x.svg"), "escaped percent signs allowed", 1);
+        for (int i = 0; i < 3; ++i)
+            std::remove(("unit_%_" + std::to_string(i) + ".svg").c_str());
+    }
+
+    // Scenes intern styles and fonts, escape text for embedding in a <script>, and store a
+    //  series with a gap as an open path of two sub-paths.
+    void testSceneJson() {
+        Scene scene("unused.json");
+        scene << Circle(Point(1, 2), 4, Fill(Color::Red)) << Circle(Point(5, 6), 2, Fill(Color::Red))
+              << Text(Point(0, 0), "a</script>\"", Fill(Color::Black));
+        Polyline series(Stroke(1, Color::Blue));
+        series << Point(0, 0) << Point(NAN, 1) << Point(2, 2) << Point(3, 3);
+        scene << series;
+
+        std::string expected = "{\"viewBox\":[-1,0,7,7],\"styles\":[[\"rgb(255,0,0)\",\"transparent\",-1,0],"
+                               "[\"rgb(0,0,0)\",\"transparent\",-1,0],[\"transparent\",\"rgb(0,0,255)\",1,0]],"
+                               "\"fonts\":[\"12px Verdana\"],\"texts\":[\"a<\\/script>\\\"\"],"
+                               "\"ops\":[0,0,3,0,0,3,7,1,4,8,2,8],\"data\":[1,2,2,5,6,1,0,0,0,0,1,0,0,2,2,2,3,3]}";
+        check(scene.toJson() == expected, "scene json", double(scene.toJson().size()));
+    }
+
+    // A bundle hoists definitions and style rules shared by its documents into one block,
+    //  leaves out the XML prolog, and does not depend on the thread count.
+    void testBundle() {
+        LinearGradient gradient;
+        gradient << Stop(0, Color::Red);
+        Symbol symbol;
+        symbol << Circle(Point(1, 1), 2, Fill(Color::Red));
+
+        Bundle bundle("unused.html", "title");
+        for (int i = 0; i < 2; ++i) {
+            Document document("unused.svg");
+            document.addStyle("circle { opacity: .5; }");
+            document << Circle(Point(i, i), 2, Fill(gradient));
+            bundle << document;
+        }
+        Document used("unused.svg");
+        used << Use(symbol, Point(3, 3));
+        bundle << used;
+
+        std::string html = bundle.toString(1);
+        check(occurrences(html, "<linearGradient") == 1 && occurrences(html, "<symbol") == 1
+              && occurrences(html, "circle { opacity") == 1, "bundle shares definitions and styles",
+              double(occurrences(html, "<linearGradient")));
+        check(occurrences(html, "<svg") == 4 && html.find("<?xml") == std::string::npos,
+              "bundle inlines documents without prolog", double(occurrences(html, "<svg")));
+        check(occurrences(html, "xlink:href=\"#symbol") == 1 && occurrences(html, "xmlns:xlink=") == 3,
+              "use references its symbol through xlink:href", double(occurrences(html, "xlink:href")));
+        check(bundle.toString(3) == html, "bundle independent of the thread count", double(html.size()));
+    }
+
+    // appendNumber and appendPoints print what streaming the double prints, on both sides of
+    //  the integer fast path.
+    void testNumberFormatting() {
+        std::vector<double> values = {0.0, -0.0, 1, -1, 999999, -999999, 1e6, -1e6, 999999.5, -999999.5, 1000001,
+                                      999999.4999999999, 0.1, 1.0 / 3, 123456.5, 9.9999995, 1234565, 12345650,
+                                      0.30000000000000004, 2.5e-7, 5e-324, 2.2250738585072014e-308, 1e300, -1e300,
+                                      std::numeric_limits<double>::max(), -std::numeric_limits<double>::max(),
+                                      2147483647.0, -2147483648.0, 4294967296.0, HUGE_VAL, -HUGE_VAL, NAN};
+        std::mt19937_64 generator(7);
+        std::uniform_int_distribution<int> integers(-2000000, 2000000), exponents(-320, 308);
+        std::uniform_real_distribution<double> mantissas(-10, 10);
+        for (int i = 0; i < 20000; ++i) {
+            values.push_back(integers(generator));
+            values.push_back(integers(generator) + 0.5);
+            values.push_back(integers(generator) / 64.0);
+            values.push_back(mantissas(generator) * std::pow(10.0, exponents(generator)));
+            values.push_back(std::nextafter(double(integers(generator)), HUGE_VAL));
+        }
+
+        std::size_t mismatches = 0;
+        std::string first_mismatch;
+        std::vector<Point> points;
+        std::string expected_points;
+        for (double value : values) {
+            std::ostringstream expected;
+            expected << value;
+            std::string actual;
+            appendNumber(actual, value);
+            if (actual != expected.str() && mismatches++ == 0)
+                first_mismatch = expected.str() + " written as " + actual;
+
+            points.push_back(Point(value, -value));
+            if (value - value == 0) {
+                std::ostringstream pair;
+                pair << value << "," << -value << " ";
+                expected_points += pair.str();
+            }
+        }
+        if (mismatches)
+            std::cout << "        first mismatch: " << first_mismatch << "\n";
+        check(mismatches == 0, "appendNumber matches streaming", double(mismatches));
+
+        std::string actual_points;
+        appendPoints(actual_points, points);
+        check(actual_points == expected_points, "appendPoints matches streaming", double(actual_points.size()));
+
+        // Blocks made only of integers take the digit pair path.
+        std::vector<Point> integral;
+        std::string expected_integral;
+        for (int i = 0; i < 1000; ++i) {
+            int x = integers(generator) / 2, y = i % 3 ? -i : i * 997;
+            integral.push_back(Point(x, y));
+            expected_integral += std::to_string(x) + "," + std::to_string(y) + " ";
+        }
+        std::string actual_integral;
+        appendPoints(actual_integral, integral);
+        check(actual_integral == expected_integral, "integer blocks match", double(actual_integral.size()));
+    }
+
+    // The C interface reports bad handles and arrays with status codes instead of throwing,
+    //  and the bulk entry points write circles as one group and rectangles as one path.
+    void testCInterface() {
+        double x[] = {1, 5}, y[] = {2, 6}, size[] = {2, 4}, width[] = {3, -2}, height[] = {1, 2};
+        svg_style style = {0xff0000, -1, -1};
+
+        check(svg_document_create(nullptr) == nullptr, "document without a file name is rejected", 0);
+        svg_document *document = svg_document_create("unit_missing_directory/c.svg");
+        check(svg_document_add_circles(nullptr, x, y, size, 2, &style) == SVG_ERROR_INVALID_ARGUMENT,
+              "circles without a document are rejected", 0);
+        check(svg_document_add_circles(document, x, nullptr, size, 2, &style) == SVG_ERROR_INVALID_ARGUMENT,
+              "circles without coordinates are rejected", 0);
+        check(svg_document_add_rects(document, x, y, nullptr, height, 2, &style) == SVG_ERROR_INVALID_ARGUMENT,
+              "rectangles without sizes are rejected", 0);
+        check(svg_document_add(document, nullptr) == SVG_ERROR_INVALID_ARGUMENT, "null shape is rejected", 0);
+        check(svg_polyline_from_xy(nullptr, y, 2, &style) == nullptr, "polyline without coordinates is rejected", 0);
+        check(svg_document_add_circles(document, nullptr, nullptr, nullptr, 0, &style) == SVG_OK,
+              "empty arrays may be null", 0);
+        check(svg_document_save(nullptr) == SVG_ERROR_INVALID_ARGUMENT, "saving without a document is rejected", 0);
+        check(svg_document_save(document) == SVG_ERROR_IO, "unwritable file is an I/O error", 0);
+
+        check(svg_document_add_circles(document, x, y, size, 2, &style) == SVG_OK, "circles are added", 0);
+        check(svg_document_add_rects(document, x, y, width, height, 2, &style) == SVG_OK, "rectangles are added", 0);
+        svg_shape *polyline = svg_polyline_from_xy(x, y, 2, nullptr);
+        check(svg_document_add(document, polyline) == SVG_OK, "polyline is added", 0);
+        svg_shape_destroy(polyline);
+
+        std::size_t length = svg_document_to_string(document, nullptr, 0);
+        std::vector<char> buffer(length + 1);
+        check(svg_document_to_string(document, buffer.data(), buffer.size()) == length && buffer[length] == '\0',
+              "to_string reports the full length", double(length));
+        std::string svg(buffer.data());
+        check(occurrences(svg, "<g fill=\"rgb(255,0,0)\"") == 1 && occurrences(svg, "<circle") == 2 &&
+              svg.find("<circle cx=\"5\" cy=\"6\" r=\"2\" />") != std::string::npos,
+              "circles share one styled group", double(occurrences(svg, "<circle")));
+        check(occurrences(svg, "<rect") == 0 && svg.find("<path d=\"M1,2h3v1h-3zM3,6h2v2h-2z\"") != std::string::npos,
+              "rectangles are one path with negative widths normalized", double(occurrences(svg, "<path")));
+        check(svg.find("<polyline") != std::string::npos, "single shapes are written as elements", 0);
+
+        char small[8];
+        bool full_length = svg_document_to_string(document, small, sizeof(small)) == length;
+        check(full_length && std::strlen(small) == 7, "to_string truncates to the buffer", double(std::strlen(small)));
+        svg_document_destroy(document);
+    }
+
+    // Reordered shapes are grouped by (type, style) keeping their relative order, shapes
+    //  appended before enabling or after disabling reordering keep their paint position, and
+    //  non-scaling strokes are not moved into a group.
+    void testReorderByStyle() {
+        Document document("unused.svg");
+        document << Circle(Point(0, 0), 1, Fill(Color::Red));
+        document.reorderByStyle();
+        document << Circle(Point(1, 1), 2, Fill(Color::Blue)) << Rectangle(Point(2, 2), 1, 1, Fill(Color::Red))
+                 << Circle(Point(3, 3), 2, Fill(Color::Red)) << Circle(Point(4, 4), 2, Fill(Color::Blue))
+                 << Line(Point(0, 0), Point(1, 1), Stroke(1, Color::Red, true));
+        std::string sorted = document.toString();
+        check(occurrences(sorted, "<g fill=\"rgb(0,0,255)\"") == 1 && occurrences(sorted, "<g fill=\"rgb(255,0,0)\"") == 1,
+              "one group per style", double(occurrences(sorted, "<g ")));
+        std::size_t first = sorted.find("<circle cx=\"0\" cy=\"0\" r=\"0.5\" fill=\"rgb(255,0,0)\"");
+        std::size_t blue = sorted.find("<circle cx=\"1\"");
+        check(first != std::string::npos && first < blue && blue < sorted.find("<circle cx=\"4\"") &&
+              sorted.find("<circle cx=\"4\"") < sorted.find("<circle cx=\"3\"") &&
+              sorted.find("<circle cx=\"3\"") < sorted.find("<rect"),
+              "shapes are stably sorted by type and style", double(blue));
+        check(sorted.find("<line x1=\"0\" y1=\"0\" x2=\"1\" y2=\"1\" stroke-width=\"1\" stroke=\"rgb(255,0,0)\" "
+                          "vector-effect=\"non-scaling-stroke\"") != std::string::npos,
+              "non-scaling strokes keep their attributes", 0);
+
+        document.reorderByStyle(false);
+        document << Circle(Point(5, 5), 2, Fill(Color::Blue));
+        std::string flushed = document.toString();
+        check(occurrences(flushed, "<g ") == 2 && flushed.find("<circle cx=\"5\" cy=\"5\" r=\"1\" fill=\"rgb(0,0,255)\"") >
+              flushed.find("<line"), "shapes appended after disabling paint on top", double(occurrences(flushed, "<g ")));
+        document.reorderByStyle(false);
+        check(document.toString() == flushed, "disabling twice changes nothing", 0);
+    }
+
+    // Memory figures follow what the objects hold: strings only count past the small string
+    //  buffer, points and batches by capacity, and the document by its markup and definitions.
+    void testMemoryUsage() {
+        check(stringMemory("short") == 0, "small strings hold no heap memory", double(stringMemory("short")));
+        std::string long_string(1000, 'x');
+        check(stringMemory(long_string) == long_string.capacity() + 1, "long strings count their capacity",
+              double(stringMemory(long_string)));
+
+        Circle circle(Point(0, 0), 1, Fill(Color::Red));
+        check(circle.memoryUsage().total() == sizeof(Circle), "a circle is just its object",
+              double(circle.memoryUsage().total()));
+
+        Polyline polyline(Stroke(1, Color::Black));
+        for (int i = 0; i < 1000; ++i)
+            polyline << Point(i, i);
+        check(polyline.memoryUsage().points >= 1000 * sizeof(Point), "polyline points are counted",
+              double(polyline.memoryUsage().points));
+
+        CircleBatch batch(Fill(Color::Red));
+        for (int i = 0; i < 1000; ++i)
+            batch.add(Point(i, i), 2);
+        MemoryUsage batch_usage = batch.memoryUsage();
+        check(batch_usage.points >= 3 * 1000 * sizeof(double), "batch columns are counted", double(batch_usage.points));
+        check(batch_usage.total() == batch_usage.objects + batch_usage.points + batch_usage.strings +
+                                     batch_usage.definitions + batch_usage.buffers,
+              "total is the sum of the parts", double(batch_usage.total()));
+
+        Document document("unused.svg");
+        MemoryUsage empty = document.memoryUsage();
+        for (int i = 0; i < 1000; ++i)
+            document << Circle(Point(i, i), 2, Fill(Color::Red));
+        MemoryUsage filled = document.memoryUsage();
+        check(filled.strings >= 1000 * std::string("\t<circle cx=\"0\" cy=\"0\" r=\"1\" />\n").size() &&
+              filled.strings > empty.strings, "document markup is counted", double(filled.strings));
+        LinearGradient gradient;
+        gradient << Stop(0, Color::Red) << Stop(1, Color::Blue);
+        document << Rectangle(Point(0, 0), 1, 1, Fill(gradient));
+        check(document.memoryUsage().definitions > filled.definitions, "definitions are counted",
+              double(document.memoryUsage().definitions));
+    }
+
+    // NaN and infinite samples split a series into runs: polylines write one element per run,
+    //  paths one sub-path per run, bounds only cover finite points and "nan" is never written.
+    void testSeriesGaps() {
+        double const gap = std::numeric_limits<double>::quiet_NaN();
+        double const inf = std::numeric_limits<double>::infinity();
+        Polyline polyline(Stroke(1, Color::Black));
+        polyline << Point(0, 0) << Point(1, 1) << Point(gap, 2) << Point(3, 3) << Point(4, inf)
+                 << Point(5, 5) << Point(-inf, 6) << Point(7, -1);
+        std::string svg = polyline.toString();
+        check(occurrences(svg, "<polyline") == 4 && svg.find("points=\"0,0 1,1 \"") != std::string::npos &&
+              svg.find("points=\"3,3 \"") != std::string::npos, "polyline gets one element per run",
+              double(occurrences(svg, "<polyline")));
+        check(svg.find("nan") == std::string::npos && svg.find("inf") == std::string::npos,
+              "non-finite values are not written", 0);
+
+        Rect bounds = polyline.MinMax();
+        check(bounds.minPt.x == 0 && bounds.minPt.y == -1 && bounds.maxPt.x == 7 && bounds.maxPt.y == 5,
+              "bounds cover finite points only", bounds.width());
+
+        std::string path = Path::fromSeries(polyline.points, Stroke(1, Color::Black)).toString();
+        check(path.find("d=\"M0,0 1,1 M3,3 M5,5 M7,-1 \"") != std::string::npos,
+              "path gets one sub-path per run", double(occurrences(path, "M")));
+
+        std::vector<Point> dense;
+        for (int i = 0; i < 100000; ++i)
+            dense.push_back(i % 1000 == 999 ? Point(i, gap) : Point(i, i % 7));
+        Path series = Path::fromSeries(dense);
+        check(occurrences(series.toString(), "M") == 100, "long series splits at every gap",
+              double(occurrences(series.toString(), "M")));
+        check(series.MinMax().maxPt.x == 99998 && series.MinMax().maxPt.y == 6, "long series bounds",
+              series.MinMax().maxPt.x);
+
+        std::vector<Point> no_finite = {Point(gap, gap), Point(inf, 1)};
+        check(Path::fromSeries(no_finite).toString().find("d=\"\"") != std::string::npos,
+              "series without finite points is empty", 0);
+        Polyline all_gaps(Stroke(1, Color::Black));
+        all_gaps << Point(gap, 0);
+        check(all_gaps.MinMax().width() == 0 && all_gaps.MinMax().height() == 0, "all gap bounds are empty", 0);
+    }
+
+    // The bulk log and power transforms stay within 1e-9 of std::log10 and std::pow over the
+    //  whole double range (relative for power), far below a pixel.  Degenerate parameters are
+    //  rejected, and setting the scales before or after adding series gives the same chart.
+    void testScales() {
+        std::mt19937_64 random(89);
+        std::uniform_real_distribution<double> exponent(-300, 300), unit(-1, 1);
+        std::vector<double> values(100000);
+        for (auto &value : values)
+            value = std::pow(10.0, exponent(random));
+
+        std::vector<double> logs = values;
+        Scale::log().apply(&logs[0], logs.size());
+        std::vector<double> log2s = values;
+        Scale::log(2).apply(&log2s[0], log2s.size());
+        double log_error = 0;
+        for (std::size_t i = 0; i < values.size(); ++i)
+            log_error = std::max(log_error, std::max(std::fabs(logs[i] - std::log10(values[i])),
+                                                     std::fabs(log2s[i] - std::log2(values[i]))));
+        check(log_error < 1e-9, "log scale against std::log10 and std::log2, absolute error", log_error);
+
+        double power_error = 0;
+        for (double p : {0.5, 2.0, 3.0, -1.0, 1.0 / 3}) {
+            std::vector<double> powers(values.size());
+            for (std::size_t i = 0; i < values.size(); ++i)
+                powers[i] = unit(random) * std::pow(10.0, exponent(random) / 4);
+            std::vector<double> scaled = powers;
+            Scale::power(p).apply(&scaled[0], scaled.size());
+            for (std::size_t i = 0; i < powers.size(); ++i) {
+                double exact = std::copysign(std::pow(std::fabs(powers[i]), p), powers[i]);
+                power_error = std::max(power_error, std::fabs(scaled[i] - exact) / std::fabs(exact));
+            }
+        }
+        check(power_error < 1e-9, "power scale against std::pow, relative error", power_error);
+
+        double symlog_error = 0;
+        for (double v : {-1e300, -12345.0, -1.0, -1e-12, 0.0, 1e-300, 0.5, 7.0, 1e300})
+            symlog_error = std::max(symlog_error, std::fabs(Scale::symlog(2)(v) -
+                                                            std::copysign(std::log10(1 + std::fabs(v) / 2), v)));
+        check(symlog_error < 1e-9, "symlog scale against std::log10, absolute error", symlog_error);
+
+        check(std::isnan(Scale::log()(0)) && std::isnan(Scale::log()(-1)) && Scale::log()(HUGE_VAL) == HUGE_VAL &&
+              std::isnan(Scale::power(2)(NAN)), "log gaps and non-finite values", 0);
+
+        int rejected = 0;
+        for (auto make : {+[] { return Scale::log(1); }, +[] { return Scale::log(0); }, +[] { return Scale::log(-2); },
+                          +[] { return Scale::log(NAN); }, +[] { return Scale::symlog(0); },
+                          +[] { return Scale::symlog(-1); }, +[] { return Scale::power(0); },
+                          +[] { return Scale::power(HUGE_VAL); }}) {
+            try {
+                make();
+            } catch (std::out_of_range const &) {
+                ++rejected;
+            }
+        }
+        check(rejected == 8, "degenerate scale parameters are rejected", rejected);
+
+        std::vector<Point> series = {Point(1, 10), Point(10, 1000), Point(100, 0), Point(1000, 1e5)};
+        LineChart before, after;
+        before.setScales(Scale::log(), Scale::symlog());
+        before << Polyline(series, Fill(), Stroke(1, Color::Blue));
+        after << Polyline(series, Fill(), Stroke(1, Color::Blue));
+        after.setScales(Scale::log(), Scale::symlog());
+        check(before.toString() == after.toString() && before.toString().find("M0,") != std::string::npos,
+              "scales apply to series added before and after", 0);
+        after.setScales(Scale(), Scale());
+        LineChart linear;
+        linear << Polyline(series, Fill(), Stroke(1, Color::Blue));
+        check(after.toString() == linear.toString(), "linear scales restore the values as added", 0);
+    }
+
+    // sinCos matches std::sin and std::cos within its documented 1e-13 for angles up to 1e6
+    //  radians, and a polar polyline writes the same points as converting each one with
+    //  std::cos and std::sin, up to the six significant digits written.
+    void testPolarPolyline() {
+        std::mt19937_64 random(90);
+        std::uniform_real_distribution<double> wide(-1e6, 1e6), turn(-7, 7), radius(0, 50);
+        std::vector<double> angles(100000), sines(angles.size()), cosines(angles.size());
+        for (std::size_t i = 0; i < angles.size(); ++i)
+            angles[i] = i % 2 ? wide(random) : turn(random);
+        sinCos(&angles[0], angles.size(), &sines[0], &cosines[0]);
+        double error = 0;
+        for (std::size_t i = 0; i < angles.size(); ++i)
+            error = std::max(error, std::max(std::fabs(sines[i] - std::sin(angles[i])),
+                                             std::fabs(cosines[i] - std::cos(angles[i]))));
+        check(error < 1e-13, "sinCos against std::sin and std::cos, absolute error", error);
+
+        Point center(100, 50);
+        PolarPolyline polar(center, Stroke(1, Color::Black));
+        std::vector<Point> exact;
+        Rect bounds;
+        for (int i = 0; i < 1000; ++i) {
+            double r = radius(random), angle = turn(random);
+            polar.add(r, angle);
+            exact.push_back(Point(center.x + r * std::cos(angle), center.y + r * std::sin(angle)));
+            if (i == 0)
+                bounds = Rect(exact.back(), 0, 0);
+            bounds.include(exact.back());
+        }
+        std::string svg = polar.toString();
+        std::istringstream points(svg.substr(svg.find("points=\"") + 8));
+        double written_error = 0;
+        std::size_t written = 0;
+        double x, y;
+        char comma;
+        while (written < exact.size() && points >> x >> comma >> y) {
+            written_error = std::max(written_error, std::max(std::fabs(x - exact[written].x),
+                                                             std::fabs(y - exact[written].y)));
+            ++written;
+        }
+        check(written == exact.size() && written_error < 1e-3 && svg.find("<polyline") == 1,
+              "polar points match std::cos and std::sin", written_error);
+
+        Rect polar_bounds = polar.MinMax();
+        double bounds_error = std::max(std::max(std::fabs(polar_bounds.minPt.x - bounds.minPt.x),
+                                                std::fabs(polar_bounds.minPt.y - bounds.minPt.y)),
+                                       std::max(std::fabs(polar_bounds.maxPt.x - bounds.maxPt.x),
+                                                std::fabs(polar_bounds.maxPt.y - bounds.maxPt.y)));
+        check(bounds_error < 1e-9, "polar bounds", bounds_error);
+
+        polar.setClosed(true);
+        check(polar.toString().find("<polygon") == 1, "closed polar lines are polygons", 0);
+    }
+
+    std::string timeLabel(TimeAxis const &axis, std::int64_t time) {
+        char label[32];
+        return std::string(label, axis.format(time, label));
+    }
+
+    // Ticks fall on calendar boundaries (Monday weeks, first of month), labels follow the
+    //  precision, and ranges reaching the int64 limits give ticks inside the range without
+    //  overflowing.  Labels are the same when formatted concurrently.
+    void testTimeAxis() {
+        std::int64_t const day = 86400000000000LL, second = 1000000000;
+        std::int64_t const year_2024 = daysFromCivil(2024, 1, 1) * day;
+
+        TimeAxis months(Point(0, 0), 100, year_2024, daysFromCivil(2024, 12, 31) * day);
+        std::vector<std::int64_t> month_ticks = months.ticks();
+        bool first_of_month = !month_ticks.empty();
+        for (auto tick : month_ticks) {
+            std::int64_t year;
+            unsigned month, day_of_month;
+            civilFromDays(tick / day, year, month, day_of_month);
+            first_of_month = first_of_month && tick % day == 0 && day_of_month == 1 && (month - 1) % 3 == 0;
+        }
+        check(first_of_month && month_ticks.size() == 4 && timeLabel(months, month_ticks[1]) == "2024-04",
+              "quarter ticks on the first of the month", double(month_ticks.size()));
+
+        TimeAxis weeks(Point(0, 0), 100, year_2024 + 3 * day / 2, year_2024 + 60 * day);
+        bool mondays = !weeks.ticks().empty();
+        for (auto tick : weeks.ticks())
+            mondays = mondays && tick % day == 0 && (tick / day + 3) % 7 == 0;
+        check(mondays && weeks.ticks().front() == daysFromCivil(2024, 1, 8) * day, "week ticks on Mondays",
+              double(weeks.ticks().size()));
+
+        std::int64_t noon = year_2024 + 12 * 3600 * second;
+        TimeAxis fine(Point(0, 0), 100, noon, noon + second);
+        check(fine.precision() == TimeAxis::Milliseconds && fine.ticks().size() == 11 &&
+              timeLabel(fine, noon + 34 * 60 * second + 56789000000LL) == "2024-01-01 12:34:56.789",
+              "millisecond labels", double(fine.ticks().size()));
+        TimeAxis before_epoch(Point(0, 0), 100, -second, 0);
+        check(timeLabel(before_epoch, -1000000) == "1969-12-31 23:59:59.999", "labels before the epoch", 0);
+
+        std::int64_t const min = std::numeric_limits<std::int64_t>::min(), max = std::numeric_limits<std::int64_t>::max();
+        bool inside = true;
+        std::size_t tick_count = 0;
+        for (auto range : {std::make_pair(min, max), std::make_pair(max - 10 * second, max),
+                           std::make_pair(min, min + 10 * second), std::make_pair(max - 100 * day, max),
+                           std::make_pair(min, min + 100 * day), std::make_pair(max - 5, max)}) {
+            TimeAxis axis(Point(0, 0), 100, range.first, range.second);
+            std::vector<std::int64_t> ticks = axis.ticks();
+            inside = inside && !ticks.empty() && ticks.size() <= 11 && std::is_sorted(ticks.begin(), ticks.end()) &&
+                     ticks.front() >= range.first && ticks.back() <= range.second;
+            tick_count += ticks.size();
+            inside = inside && axis.toString().find("nan") == std::string::npos;
+        }
+        check(inside, "ticks at the int64 limits stay inside the range", double(tick_count));
+
+        std::vector<std::int64_t> times(10000);
+        for (std::size_t i = 0; i < times.size(); ++i)
+            times[i] = year_2024 + std::int64_t(i) * 7919 * second;
+        TimeAxis shared(Point(0, 0), 100, noon, noon + 10 * second);
+        std::vector<std::string> serial(times.size()), concurrent(times.size());
+        for (std::size_t i = 0; i < times.size(); ++i)
+            serial[i] = timeLabel(shared, times[i]);
+        parallelFor(times.size(), [&](std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i)
+                concurrent[i] = timeLabel(shared, times[i]);
+        }, 4);
+        check(serial == concurrent, "labels formatted concurrently", 0);
+    }
+
+    // Circle batches write styled groups of <circle> elements, or with Arcs output one path
+    //  per style of two half circle arcs each.  Both skip non-finite circles and give the
+    //  same bounds.
+    void testCircleBatch() {
+        std::string svg[2];
+        Rect bounds[2];
+        CircleBatch::Output outputs[] = {CircleBatch::Elements, CircleBatch::Arcs};
+        for (int mode = 0; mode < 2; ++mode) {
+            CircleBatch batch(Fill(Color::Red), Stroke(), outputs[mode]);
+            std::uint32_t blue = batch.addStyle(Fill(Color::Blue));
+            batch.add(Point(1, 2), 4).add(Point(5, 5), 2, blue).add(Point(NAN, 1), 2).add(Point(7, 1), 1);
+            svg[mode] = batch.toString();
+            bounds[mode] = batch.MinMax();
+        }
+        check(occurrences(svg[0], "<circle") == 3 && svg[0].find("<circle cx=\"5\" cy=\"5\" r=\"1\" />") >
+              svg[0].find("<g fill=\"rgb(0,0,255)\""), "elements output writes styled circles",
+              double(occurrences(svg[0], "<circle")));
+        check(svg[1] == "\t<path d=\"M-1,2a2,2 0 1,0 4,0a2,2 0 1,0 -4,0M6.5,1a0.5,0.5 0 1,0 1,0a0.5,0.5 0 1,0 -1,0\" "
+                        "fill=\"rgb(255,0,0)\" />\n"
+                        "\t<path d=\"M4,5a1,1 0 1,0 2,0a1,1 0 1,0 -2,0\" fill=\"rgb(0,0,255)\" />\n",
+              "arcs output writes one path per style", double(occurrences(svg[1], "<path")));
+        check(svg[0].find("nan") == std::string::npos && svg[1].find("nan") == std::string::npos,
+              "non-finite circles are skipped", 0);
+        check(bounds[0].minPt.x == -1 && bounds[0].minPt.y == 0 && bounds[0].maxPt.x == 7.5 && bounds[0].maxPt.y == 6 &&
+              bounds[1].minPt.x == -1 && bounds[1].maxPt.x == 7.5, "batch bounds leave skipped circles out",
+              bounds[0].width());
+
+        std::vector<double> xs(100000), ys(xs.size()), sizes(xs.size(), 2);
+        for (std::size_t i = 0; i < xs.size(); ++i) {
+            xs[i] = double(i % 1000);
+            ys[i] = i % 997 == 0 ? HUGE_VAL : double(i / 1000);
+        }
+        CircleBatch elements(Fill(Color::Red)), arcs(Fill(Color::Red), Stroke(), CircleBatch::Arcs);
+        elements.add(&xs[0], &ys[0], &sizes[0], xs.size());
+        arcs.add(&xs[0], &ys[0], &sizes[0], xs.size());
+        std::size_t finite = xs.size() - (xs.size() + 996) / 997;
+        check(occurrences(elements.toString(), "<circle") == finite && occurrences(arcs.toString(), "M") == finite,
+              "array input writes every finite circle", double(finite));
+    }
+
+    // Rectangle batches write styled groups of <rect> elements, or by default one path per
+    //  style.  Negative sizes extend a rectangle left or up in both, non-finite ones are
+    //  skipped and left out of the bounds.
+    void testRectangleBatch() {
+        std::string svg[2];
+        Rect bounds[2];
+        RectangleBatch::Output outputs[] = {RectangleBatch::Elements, RectangleBatch::Paths};
+        for (int mode = 0; mode < 2; ++mode) {
+            RectangleBatch batch(Fill(Color::Red), Stroke(), outputs[mode]);
+            std::uint32_t blue = batch.addStyle(Fill(Color::Blue));
+            batch.add(Point(1, 2), 4, -2).add(Point(5, 5), -2, 3, blue).add(Point(1, 1), NAN, 2).add(Point(7, 1), 1, 1);
+            svg[mode] = batch.toString();
+            bounds[mode] = batch.MinMax();
+        }
+        check(occurrences(svg[0], "<rect") == 3 && svg[0].find("<rect x=\"1\" y=\"0\" width=\"4\" height=\"2\" />") !=
+              std::string::npos && svg[0].find("<rect x=\"3\" y=\"5\" width=\"2\" height=\"3\" />") != std::string::npos,
+              "elements output normalizes negative sizes", double(occurrences(svg[0], "<rect")));
+        check(svg[1] == "\t<path d=\"M1,0h4v2h-4zM7,1h1v1h-1z\" fill=\"rgb(255,0,0)\" />\n"
+                        "\t<path d=\"M3,5h2v3h-2z\" fill=\"rgb(0,0,255)\" />\n",
+              "paths output writes one path per style", double(occurrences(svg[1], "<path")));
+        check(RectangleBatch().add(Point(0, 0), 1, 1).toString().find("<path") != std::string::npos,
+              "paths are the default output", 0);
+        check(bounds[0].minPt.x == 1 && bounds[0].minPt.y == 0 && bounds[0].maxPt.x == 8 && bounds[0].maxPt.y == 8 &&
+              bounds[1].minPt.x == 1 && bounds[1].maxPt.y == 8, "bounds cover normalized finite rectangles",
+              bounds[0].width());
+    }
+
+    // Endpoints of a line batch path, resolving the relative commands.
+    std::vector<Point> pathEndpoints(std::string const &svg) {
+        std::vector<Point> ret;
+        std::string d = svg.substr(svg.find("d=\"") + 3);
+        d = d.substr(0, d.find('"'));
+        std::istringstream ss(d);
+        Point current(0, 0);
+        char command;
+        double x, y;
+        char comma;
+        while (ss >> command >> x >> comma >> y) {
+            bool relative = command == 'm' || command == 'l';
+            current = relative ? Point(current.x + x, current.y + y) : Point(x, y);
+            ret.push_back(current);
+        }
+        return ret;
+    }
+
+    // Line batches round endpoints to the precision before taking offsets, so a long chain of
+    //  relative segments ends exactly where the rounded input does.  Coordinates beyond fixed
+    //  point are written absolute and unrounded, non-finite segments are skipped.
+    void testLineBatch() {
+        std::mt19937_64 random(94);
+        std::uniform_real_distribution<double> step(-3.3333, 3.3333);
+        LineBatch chain(Stroke(1, Color::Black));
+        std::vector<Point> expected;
+        Point at(0.004, 0.006);
+        for (int i = 0; i < 10000; ++i) {
+            Point next(at.x + step(random), at.y + step(random));
+            chain.add(at, next);
+            expected.push_back(Point(std::round(at.x * 100) / 100, std::round(at.y * 100) / 100));
+            expected.push_back(Point(std::round(next.x * 100) / 100, std::round(next.y * 100) / 100));
+            at = next;
+        }
+        std::vector<Point> endpoints = pathEndpoints(chain.toString());
+        double drift = endpoints.size() == expected.size() ? 0 : HUGE_VAL;
+        for (std::size_t i = 0; i < endpoints.size() && i < expected.size(); ++i)
+            drift = std::max(drift, std::max(std::fabs(endpoints[i].x - expected[i].x),
+                                             std::fabs(endpoints[i].y - expected[i].y)));
+        check(drift < 1e-6, "relative segments do not drift, largest error", drift);
+        check(chain.toString().find("m0,0l") != std::string::npos, "connected segments move by zero", 0);
+
+        LineBatch mixed(Stroke(1, Color::Black));
+        mixed.add(Point(0.123, 0.456), Point(1.001, 2.999)).add(Point(1e300, 0), Point(2e300, 1))
+             .add(Point(NAN, 1), Point(1, 1)).add(Point(5, 5), Point(6, HUGE_VAL)).add(Point(5, 5), Point(6, 6));
+        check(mixed.toString().find("d=\"M0.12,0.46l0.88,2.54M1e+300,0L2e+300,1M5,5l1,1\"") != std::string::npos,
+              "huge coordinates are written absolute", 0);
+        check(mixed.setPrecision(0).toString().find("d=\"M0,0l1,3M1e+300,0L2e+300,1M5,5l1,1\"") != std::string::npos,
+              "precision 0 rounds to integers", 0);
+        check(mixed.MinMax().minPt.x == 0.123 && mixed.MinMax().maxPt.x == 2e300 && mixed.MinMax().maxPt.y == 6,
+              "bounds leave non-finite segments out", mixed.MinMax().maxPt.y);
+        LineBatch precise(Stroke(1, Color::Black));
+        precise.add(Point(0, 0), Point(1.0 / 3, 0)).setPrecision(12);
+        check(precise.toString().find("l0.333333333,0") != std::string::npos, "precision is limited to 9 decimals", 0);
+    }
+
+    // Candlestick decimation: every column holds the open, high, low, close and volume of the
+    //  ticks falling in it, as a direct pass computes them, for any thread count.  The output
+    //  size depends on the width only, non-finite prices are skipped.
+    void testCandlestickDecimation() {
+        std::int64_t const start = 1700000000000000000LL, end = start + 3600LL * 1000000000;
+        std::mt19937_64 random(98);
+        std::uniform_int_distribution<std::int64_t> when(start - 1000, end + 1000);
+        std::normal_distribution<double> move(0, 1);
+        std::vector<std::int64_t> times(400000);
+        std::vector<double> prices(times.size()), volumes(times.size(), 1);
+        double price = 100;
+        for (std::size_t i = 0; i < times.size(); ++i) {
+            times[i] = when(random);
+            price += move(random);
+            prices[i] = i % 1000 == 0 ? NAN : price;
+        }
+
+        CandlestickChart serial(Rect(Point(0, 0), 200, 100), start, end), threaded(Rect(Point(0, 0), 200, 100), start, end);
+        serial.add(times, prices, volumes, 1);
+        threaded.add(times, prices, volumes, 4);
+        std::vector<CandlestickChart::Candle> const &candles = serial.getCandles();
+
+        std::vector<CandlestickChart::Candle> direct(candles.size());
+        std::vector<bool> seen(candles.size(), false);
+        for (std::size_t i = 0; i < times.size(); ++i) {
+            if (times[i] < start || times[i] >= end || std::isnan(prices[i]))
+                continue;
+            std::size_t column = std::size_t((times[i] - start) / ((end - start) / std::int64_t(candles.size())));
+            CandlestickChart::Candle &candle = direct[column];
+            if (!seen[column] || times[i] < candle.open_time)
+                candle.open_time = times[i], candle.open = prices[i];
+            if (!seen[column] || times[i] >= candle.close_time)
+                candle.close_time = times[i], candle.close = prices[i];
+            candle.high = seen[column] ? std::max(candle.high, prices[i]) : prices[i];
+            candle.low = seen[column] ? std::min(candle.low, prices[i]) : prices[i];
+            candle.volume = (seen[column] ? candle.volume : 0) + 1;
+            seen[column] = true;
+        }
+        std::size_t mismatches = candles.size() == 200 ? 0 : 1;
+        for (std::size_t i = 0; i < candles.size() && i < direct.size(); ++i) {
+            CandlestickChart::Candle const &a = candles[i], &b = direct[i], &c = threaded.getCandles()[i];
+            mismatches += !seen[i] || a.open != b.open || a.close != b.close || a.high != b.high || a.low != b.low ||
+                          a.volume != b.volume || a.open != c.open || a.close != c.close || a.high != c.high ||
+                          a.low != c.low || a.volume != c.volume;
+        }
+        check(mismatches == 0, "candles match a direct pass on one and four threads", double(mismatches));
+
+        std::string svg = serial.toString();
+        check(occurrences(svg, "M") == 2 * candles.size() && svg.find("nan") == std::string::npos,
+              "one wick and one body per column", double(occurrences(svg, "M")));
+        serial.add(times, prices, volumes);
+        check(serial.toString().size() < svg.size() * 11 / 10, "output size does not grow with the ticks",
+              double(serial.toString().size()));
+    }
+
+    // Forward and inverse transforms of random data give back the input.
+    void testFftRoundTrip() {
+        std::mt19937_64 generator(1);
+        std::uniform_real_distribution<double> uniform(-1, 1);
+        for (std::size_t count : {1, 2, 8, 1024}) {
+            std::vector<std::complex<double> > data(count), input;
+            for (auto &value : data)
+                value = std::complex<double>(uniform(generator), uniform(generator));
+            input = data;
+
+            std::vector<std::complex<double> > twiddles = fftTwiddles(count);
+            fft(data.data(), count, twiddles.data(), false);
+            fft(data.data(), count, twiddles.data(), true);
+
+            double error = 0;
+            for (std::size_t i = 0; i < count; ++i)
+                error = std::max(error, std::abs(data[i] / double(count) - input[i]));
+            check(error < 1e-12, "fft round trip of " + std::to_string(count), error);
+        }
+    }
+
+    // The FFT smoothed grid matches a Gaussian KDE summed directly over the points at the
+    //  cell centers, up to the binning error.
+    void testDensityMatchesDirectKde() {
+        std::mt19937_64 generator(2);
+        std::normal_distribution<double> normal(0, 1);
+        std::vector<Point> points(2000);
+        for (auto &point : points)
+            point = Point(300 + normal(generator) * 60, 200 + normal(generator) * 40);
+
+        unsigned const cells = 64;
+        double const bandwidth = 20;
+        Rect area(Point(0, 0), 600, 400);
+        DensityContours contours(area, std::vector<Fill>(1, Fill(Color::Red)), cells, cells, bandwidth);
+        contours.add(points);
+        std::vector<double> density = contours.density();
+
+        double error = 0, peak = 0;
+        for (unsigned row = 0; row < cells; row += 3) {
+            for (unsigned column = 0; column < cells; column += 3) {
+                double x = (column + 0.5) * area.width() / cells, y = (row + 0.5) * area.height() / cells;
+                double sum = 0;
+                for (auto const &point : points) {
+                    double dx = x - point.x, dy = y - point.y;
+                    sum += std::exp(-(dx * dx + dy * dy) / (2 * bandwidth * bandwidth));
+                }
+                sum /= 2 * M_PI * bandwidth * bandwidth * points.size();
+                error = std::max(error, std::fabs(sum - density[row * cells + column]));
+                peak = std::max(peak, sum);
+            }
+        }
+        check(error < 0.03 * peak, "density against direct kde, relative error", error / peak);
+
+        // The automatic bandwidth does not depend on where the data lies.
+        double peaks[2];
+        for (int shifted = 0; shifted < 2; ++shifted) {
+            double offset = shifted ? 1e9 : 0;
+            std::vector<Point> moved(points);
+            for (auto &point : moved)
+                point = Point(point.x + offset, point.y + offset);
+            DensityContours automatic(Rect(Point(offset, offset), 600, 400));
+            automatic.add(moved);
+            std::vector<double> values = automatic.density();
+            peaks[shifted] = *std::max_element(values.begin(), values.end());
+        }
+        check(std::fabs(peaks[1] - peaks[0]) < 1e-3 * peaks[0], "density far from the origin, relative change",
+              std::fabs(peaks[1] - peaks[0]) / peaks[0]);
+    }
+
+    // Largest difference between q and the true rank of the sketch's q-quantile, for a
+    //  permutation of 0 .. count - 1 where the rank of a value is the value itself.
+    double rankError(QuantileSketch const &sketch, double count) {
+        std::vector<double> qs, values;
+        for (int i = 1; i < 100; ++i)
+            qs.push_back(i / 100.0);
+        values.resize(qs.size());
+        sketch.quantiles(qs.data(), qs.size(), values.data());
+
+        double error = 0;
+        for (std::size_t i = 0; i < qs.size(); ++i)
+            error = std::max(error, std::fabs(values[i] / count - qs[i]));
+        return error;
+    }
+
+    void testQuantileSketch() {
+        std::size_t const count = 1000000;
+        std::vector<double> values(count);
+        for (std::size_t i = 0; i < count; ++i)
+            values[i] = double(i);
+        std::shuffle(values.begin(), values.end(), std::mt19937_64(3));
+
+        QuantileSketch whole(200);
+        whole.add(values.data(), count);
+        double weight = 0;
+        for (auto const &item : whole.weightedItems())
+            weight += double(item.second);
+        check(whole.count() == count && weight == count, "sketch weights add up to the count", weight);
+        check(rankError(whole, count) < 2.5 / 200, "sketch rank error", rankError(whole, count));
+
+        // Sketches of parts merge into one with the same guarantees.
+        QuantileSketch merged(200, 2);
+        for (std::size_t part = 0; part < 4; ++part) {
+            QuantileSketch sketch(200, 3 + part);
+            sketch.add(values.data() + part * count / 4, count / 4);
+            merged.merge(sketch);
+        }
+        check(merged.count() == count && merged.min() == 0 && merged.max() == count - 1,
+              "merged sketch count and extremes", double(merged.count()));
+        check(rankError(merged, count) < 2.5 / 200, "merged sketch rank error", rankError(merged, count));
+    }
+
+    // Nodes of a random forest with long chains stay a sibling distance apart within each
+    //  level, and parents are centered over their children.
+    void testTreeLayoutSpacing() {
+        std::size_t const count = 20000;
+        std::mt19937_64 generator(4);
+        std::vector<std::int32_t> parents(count, -1);
+        for (std::size_t i = 1; i < count; ++i) {
+            if (i % 1000 == 0)
+                continue;
+            std::size_t window = i % 7 == 0 ? 1 : i;
+            parents[i] = std::int32_t(i - 1 - generator() % window);
+        }
+
+        TreeLayout tree(parents);
+        tree.layout(2, 3);
+
+        std::map<double, std::vector<double> > levels;
+        for (std::size_t i = 0; i < count; ++i)
+            levels[tree.position(i).y].push_back(tree.position(i).x);
+        double gap = HUGE_VAL;
+        for (auto &level : levels) {
+            std::sort(level.second.begin(), level.second.end());
+            for (std::size_t i = 1; i < level.second.size(); ++i)
+                gap = std::min(gap, level.second[i] - level.second[i - 1]);
+        }
+        check(gap > 2 - 1e-9, "tree layout smallest gap within a level", gap);
+
+        std::vector<double> lowest(count, HUGE_VAL), highest(count, -HUGE_VAL);
+        for (std::size_t i = 0; i < count; ++i) {
+            if (parents[i] < 0)
+                continue;
+            lowest[parents[i]] = std::min(lowest[parents[i]], tree.position(i).x);
+            highest[parents[i]] = std::max(highest[parents[i]], tree.position(i).x);
+        }
+        double offset = 0;
+        for (std::size_t i = 0; i < count; ++i)
+            if (lowest[i] <= highest[i])
+                offset = std::max(offset, std::fabs(tree.position(i).x - (lowest[i] + highest[i]) / 2));
+        check(offset < 1e-6, "tree layout parents centered over children", offset);
+    }
+
+    // Treemap areas are proportional to the subtree weights, children stay inside their
+    //  parent and siblings do not overlap.
+    void testTreemapAreas() {
+        std::size_t const count = 3000;
+        std::mt19937_64 generator(5);
+        std::uniform_real_distribution<double> uniform(1, 100);
+        std::vector<std::int32_t> parents(count, -1);
+        std::vector<double> weights(count);
+        for (std::size_t i = 0; i < count; ++i) {
+            if (i % 500)
+                parents[i] = std::int32_t(generator() % i);
+            weights[i] = uniform(generator);
+        }
+
+        Rect box(Point(0, 0), 10000, 6000);
+        Treemap treemap(parents, weights);
+        treemap.layout(box);
+
+        double roots = 0;
+        for (std::size_t i = 0; i < count; ++i)
+            roots += parents[i] < 0 ? treemap.total(i) : 0;
+
+        std::size_t visible = 0;
+        double error = 0, outside = 0;
+        std::vector<std::vector<std::size_t> > children(count + 1);
+        for (std::size_t i = 0; i < count; ++i) {
+            if (!treemap.visible(i))
+                continue;
+            ++visible;
+            Rect bounds = treemap.bounds(i);
+            double expected = treemap.total(i) / roots * box.width() * box.height();
+            error = std::max(error, std::fabs(bounds.width() * bounds.height() / expected - 1));
+
+            Rect parent = parents[i] < 0 ? box : treemap.bounds(parents[i]);
+            outside = std::max(outside, std::max(std::max(parent.minPt.x - bounds.minPt.x, parent.minPt.y - bounds.minPt.y),
+                                                 std::max(bounds.maxPt.x - parent.maxPt.x, bounds.maxPt.y - parent.maxPt.y)));
+            children[parents[i] < 0 ? count : parents[i]].push_back(i);
+        }
+        check(visible == count, "treemap nodes visible", double(visible));
+        check(error < 1e-9, "treemap area relative to weight", error);
+        check(outside < 1e-6, "treemap children inside parents", outside);
+
+        double overlap = 0;
+        for (auto const &siblings : children) {
+            for (std::size_t a = 0; a < siblings.size(); ++a) {
+                for (std::size_t b = a + 1; b < siblings.size(); ++b) {
+                    Rect first = treemap.bounds(siblings[a]), second = treemap.bounds(siblings[b]);
+                    double width = std::min(first.maxPt.x, second.maxPt.x) - std::max(first.minPt.x, second.minPt.x);
+                    double height = std::min(first.maxPt.y, second.maxPt.y) - std::max(first.minPt.y, second.minPt.y);
+                    if (width > 0 && height > 0)
+                        overlap = std::max(overlap, width * height);
+                }
+            }
+        }
+        check(overlap < 1e-6, "treemap sibling overlap", overlap);
+    }
+
+    // The same graph laid out on one and several threads gives identical positions, and
+    //  connected nodes end up closer together than random pairs.
+    void testGraphLayoutThreads() {
+        std::size_t const count = 3000;
+        std::mt19937_64 generator(6);
+        std::vector<std::pair<std::uint32_t, std::uint32_t> > edges;
+        for (std::uint32_t i = 1; i < count; ++i)
+            edges.push_back(std::make_pair(std::uint32_t(generator() % i), i));
+
+        std::vector<Point> layouts[3];
+        unsigned const threads[3] = {1, 3, 8};
+        for (int run = 0; run < 3; ++run) {
+            GraphLayout graph(count, 7);
+            for (auto const &edge : edges)
+                graph.addEdge(edge.first, edge.second);
+            graph.run(40, threads[run]);
+            layouts[run] = graph.getPositions();
+        }
+
+        std::size_t differences = 0;
+        for (int run = 1; run < 3; ++run)
+            for (std::size_t i = 0; i < count; ++i)
+                differences += layouts[run][i].x != layouts[0][i].x || layouts[run][i].y != layouts[0][i].y;
+        check(differences == 0, "graph layout differences across thread counts", double(differences));
+
+        auto distance = [&](std::size_t a, std::size_t b) {
+            return std::hypot(layouts[0][a].x - layouts[0][b].x, layouts[0][a].y - layouts[0][b].y);
+        };
+        double edge_length = 0, random_length = 0;
+        for (auto const &edge : edges) {
+            edge_length += distance(edge.first, edge.second);
+            random_length += distance(generator() % count, generator() % count);
+        }
+        check(edge_length < 0.5 * random_length, "graph layout edge length relative to random pairs",
+              edge_length / random_length);
+    }
+}
+
+int main() {
+    testDefinitionDeduplication();
+    testAnimationFrames();
+    testSceneJson();
+    testBundle();
+    testNumberFormatting();
+    testCInterface();
+    testReorderByStyle();
+    testMemoryUsage();
+    testSeriesGaps();
+    testScales();
+    testPolarPolyline();
+    testTimeAxis();
+    testCircleBatch();
+    testRectangleBatch();
+    testLineBatch();
+    testCandlestickDecimation();
+    testFftRoundTrip();
+    testDensityMatchesDirectKde();
+    testQuantileSketch();
+    testTreeLayoutSpacing();
+    testTreemapAreas();
+    testGraphLayoutThreads();
+
+    std::cout << (failures ? std::to_string(failures) + " checks failed" : std::string("all checks passed")) << "\n";
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,158 @@
+
+/*******************************************************************************
+*  The "New BSD License" : http://www.opensource.org/licenses/bsd-license.php  *
+********************************************************************************
+
+Copyright (c) 2010, Mark Turney
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+#include "simple_svg_1.0.0.hpp"
+
+#include <sstream>
+
+using namespace svg;
+
+// Checks of the C++20 generator path of StreamingDocument: streamed shapes come out as the
+//  eager Document writes them, one at a time, and errors in the generator reach the caller.
+//  Registered with CTest as "generator" when the compiler supports coroutines.
+
+#ifndef SVG_HAS_COROUTINES
+#error "tests_generator_1.0.0.cpp needs a compiler with C++20 coroutines"
+#endif
+
+namespace {
+    int failures = 0;
+
+    void check(bool passed, std::string const &name, double value) {
+        std::cout << (passed ? "ok     " : "FAILED ") << name << " (" << value << ")\n";
+        failures += !passed;
+    }
+
+    std::size_t elementCount(std::string const &text) {
+        std::size_t count = 0;
+        for (std::size_t at = text.find("/>"); at != std::string::npos; at = text.find("/>", at + 1))
+            ++count;
+        return count;
+    }
+
+    // Shapes are temporaries, a gradient is shared between them.  When the generator resumes
+    //  after shape i the document must already have written it out.
+    Generator<Shape const &> shapes(int count, std::ostringstream const *out = nullptr,
+                                    int *written_before_next = nullptr) {
+        LinearGradient gradient;
+        gradient << Stop(0, Color::Red) << Stop(1, Color::Blue);
+        for (int i = 0; i < count; ++i) {
+            if (i % 3 == 0)
+                co_yield Circle(Point(i, i / 2.0), 3, Fill(gradient));
+            else if (i % 3 == 1)
+                co_yield Rectangle(Point(i, -i), 2, 1.5, Fill(Color::Green), Stroke(.5, Color::Black));
+            else
+                co_yield Line(Point(0, i), Point(i, 0), Stroke(1, Color::Blue));
+            if (out && written_before_next)
+                *written_before_next += elementCount(out->str()) == std::size_t(i + 1);
+        }
+    }
+
+    Generator<Shape const &> failing() {
+        co_yield Circle(Point(0, 0), 1, Fill(Color::Red));
+        throw std::runtime_error("generator failed");
+    }
+
+    std::string between(std::string const &text, std::string const &begin, std::string const &end) {
+        std::size_t from = text.find(begin);
+        std::size_t to = text.find(end, from);
+        if (from == std::string::npos || to == std::string::npos)
+            return "";
+        return text.substr(from, to + end.size() - from);
+    }
+
+    // Body of a document: the shapes after the opening <svg> tag, with the <defs> block taken out.
+    std::string shapesOf(std::string const &svg) {
+        std::string body = svg.substr(svg.find(">\n", svg.find("<svg ")) + 2);
+        std::string defs = between(body, "<defs>", "</defs>\n");
+        if (!defs.empty())
+            body.erase(body.find(defs), defs.size());
+        return body;
+    }
+
+    void testMatchesEagerDocument() {
+        int const count = 1000;
+        std::ostringstream out;
+        StreamingDocument streaming(out, Layout(Dimensions(100, 100)), 4096);
+        streaming << shapes(count);
+        Rect streamed_region = streaming.region;
+        check(streaming.shapeCount() == std::size_t(count), "every generated shape is written",
+              double(streaming.shapeCount()));
+        check(streaming.close(), "stream is good", 0);
+
+        Document document("unused.svg", Layout(Dimensions(100, 100)));
+        for (Shape const &shape : shapes(count))
+            document << shape;
+        std::string eager = document.toString();
+        std::string streamed = out.str();
+
+        check(!shapesOf(streamed).empty() && shapesOf(streamed) == shapesOf(eager),
+              "shapes match the eager document", double(shapesOf(streamed).size()));
+        check(between(streamed, "<defs>", "</defs>") == between(eager, "<defs>", "</defs>") &&
+              between(streamed, "<linearGradient", ">").size() > 0,
+              "definitions match the eager document", double(between(streamed, "<defs>", "</defs>").size()));
+        check(streamed_region.minPt.x == document.region.minPt.x && streamed_region.minPt.y == document.region.minPt.y &&
+              streamed_region.maxPt.x == document.region.maxPt.x && streamed_region.maxPt.y == document.region.maxPt.y,
+              "bounds match the eager document", streamed_region.width());
+    }
+
+    void testLazyProduction() {
+        std::ostringstream out;
+        int written_before_next = 0;
+        {
+            StreamingDocument streaming(out, Layout(), 1);
+            streaming << shapes(30, &out, &written_before_next);
+        }
+        check(written_before_next == 30, "each shape is written before the next is produced", written_before_next);
+    }
+
+    void testGeneratorErrors() {
+        std::ostringstream out;
+        StreamingDocument streaming(out);
+        bool thrown = false;
+        try {
+            streaming << failing();
+        } catch (std::runtime_error const &) {
+            thrown = true;
+        }
+        check(thrown && streaming.shapeCount() == 1, "generator exceptions reach the caller",
+              double(streaming.shapeCount()));
+    }
+}
+
+int main() {
+    testMatchesEagerDocument();
+    testLazyProduction();
+    testGeneratorErrors();
+    std::cout << (failures ? "some checks failed" : "all checks passed") << "\n";
+    return failures ? 1 : 0;
+}
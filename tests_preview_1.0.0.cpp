@@ -0,0 +1,147 @@
+
+/*******************************************************************************
+*  The "New BSD License" : http://www.opensource.org/licenses/bsd-license.php  *
+********************************************************************************
+
+Copyright (c) 2010, Mark Turney
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the <organization> nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+******************************************************************************/
+
+#define SVG_PREVIEW_SERVER
+#include "simple_svg_1.0.0.hpp"
+
+using namespace svg;
+
+// Loopback smoke test of PreviewServer: a viewer connects to /events and has to receive the
+//  stream header, the current document and then the shapes appended afterwards.  Registered
+//  with CTest as "preview".
+
+namespace {
+    int failures = 0;
+
+    void check(bool passed, std::string const &name) {
+        std::cout << (passed ? "ok     " : "FAILED ") << name << "\n";
+        failures += !passed;
+    }
+
+    int connectTo(unsigned short port) {
+        int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_in address;
+        std::memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // Appends what the server sent, it runs on this thread so it is polled in between.
+    void receiveAvailable(PreviewServer &server, int fd, std::string &received) {
+        for (int round = 0; round < 20; ++round) {
+            server.poll(10);
+            char buffer[4096];
+            ssize_t length;
+            while ((length = ::recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0)
+                received.append(buffer, length);
+        }
+    }
+
+    bool sendRequest(int fd, std::string const &path) {
+        std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        return ::send(fd, request.data(), request.size(), MSG_NOSIGNAL) == ssize_t(request.size());
+    }
+}
+
+int main() {
+    PreviewServer server;
+    unsigned short port = 18931;
+    while (!server.listen(port) && port < 18961)
+        ++port;
+    if (port == 18961) {
+        std::cout << "FAILED no free loopback port\n";
+        return 1;
+    }
+
+    Document document("unused.svg");
+    document << Circle(Point(1, 1), 2, Fill(Color::Red));
+    server.attach(document);
+
+    int viewer = connectTo(port);
+    check(viewer >= 0 && sendRequest(viewer, "/events"), "viewer connects");
+    std::string stream;
+    receiveAvailable(server, viewer, stream);
+    std::size_t header = stream.find("Content-Type: text/event-stream");
+    std::size_t reset = stream.find("event: reset");
+    check(stream.compare(0, 15, "HTTP/1.1 200 OK") == 0 && header != std::string::npos,
+          "event stream header comes first");
+    check(reset > header && stream.find("<circle", reset) != std::string::npos,
+          "reset event carries the current document");
+
+    // Appending only buffers, the shapes go out on the next poll.
+    std::size_t before = stream.size();
+    document << Rectangle(Point(5, 5), 2, 2, Fill(Color::Blue));
+    char buffer[256];
+    check(::recv(viewer, buffer, sizeof(buffer), MSG_DONTWAIT) < 0, "appending does no network I/O");
+    receiveAvailable(server, viewer, stream);
+    std::size_t shape = stream.find("event: shape", before);
+    check(shape != std::string::npos && stream.find("<rect", shape) != std::string::npos,
+          "appended shape is pushed as an event");
+
+    // A page request is answered and closed, an unknown path is a 404.
+    int page = connectTo(port);
+    std::string response;
+    if (page >= 0 && sendRequest(page, "/"))
+        receiveAvailable(server, page, response);
+    check(response.compare(0, 15, "HTTP/1.1 200 OK") == 0 && response.find("EventSource") != std::string::npos,
+          "viewer page is served");
+    int missing = connectTo(port);
+    response.clear();
+    if (missing >= 0 && sendRequest(missing, "/missing"))
+        receiveAvailable(server, missing, response);
+    check(response.compare(0, 22, "HTTP/1.1 404 Not Found") == 0, "unknown path is not found");
+
+    // Viewers that go away are dropped, the others keep streaming.
+    int second = connectTo(port);
+    std::string second_stream;
+    if (second >= 0 && sendRequest(second, "/events"))
+        receiveAvailable(server, second, second_stream);
+    ::close(viewer);
+    server.poll(10);
+    before = second_stream.size();
+    document << Circle(Point(7, 7), 1, Fill(Color::Green));
+    receiveAvailable(server, second, second_stream);
+    check(second_stream.find("event: shape", before) != std::string::npos,
+          "remaining viewer streams after another one disconnected");
+
+    ::close(page);
+    ::close(missing);
+    ::close(second);
+    std::cout << (failures ? "some checks failed" : "all checks passed") << "\n";
+    return failures ? 1 : 0;
+}